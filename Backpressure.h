@@ -0,0 +1,45 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <string_view>
+
+// What a client's outbound queue does once the client stops keeping up.
+// A client is congested from the moment its queued bytes would pass
+// high_water (or low_water while all clients together hold more than
+// memory_budget) until it drains back below low_water.
+enum class BackpressurePolicy {
+    // Discard the oldest queued messages to make room for new ones.
+    DropOldest,
+    // Discard chat traffic but keep system notices, up to twice high_water.
+    DropNonSystem,
+    // Discard new messages; disconnect if still congested after disconnect_after.
+    Disconnect
+};
+
+// Whether a payload may be shed by DropNonSystem.
+enum class Traffic {
+    System,
+    Chat
+};
+
+struct BackpressureConfig {
+    size_t high_water = 256 * 1024;
+    size_t low_water = 64 * 1024;
+    size_t memory_budget = 256 * 1024 * 1024;
+    BackpressurePolicy policy = BackpressurePolicy::DropOldest;
+    std::chrono::milliseconds disconnect_after{5000};
+};
+
+// Accepts drop-oldest, drop-non-system or disconnect.
+inline bool parsePolicy(std::string_view name, BackpressurePolicy& policy) {
+    if(name == "drop-oldest") {
+        policy = BackpressurePolicy::DropOldest;
+    } else if(name == "drop-non-system") {
+        policy = BackpressurePolicy::DropNonSystem;
+    } else if(name == "disconnect") {
+        policy = BackpressurePolicy::Disconnect;
+    } else {
+        return false;
+    }
+    return true;
+}
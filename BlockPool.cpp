@@ -0,0 +1,92 @@
+#include "BlockPool.h"
+#include <algorithm>
+
+// The pools are function-local statics in the modules that use them; this
+// list only serves stats().
+static std::mutex& registryMutex() {
+    static std::mutex instance;
+    return instance;
+}
+
+static std::vector<BlockPool*>& registry() {
+    static std::vector<BlockPool*> instance;
+    return instance;
+}
+
+BlockPool::BlockPool(const char* name, size_t block_size, size_t max_free)
+    : name_(name), block_size_(block_size), max_free_(max_free) {
+    // Reserved up front so deallocate() never has to grow it.
+    free_.reserve(max_free_);
+
+    std::lock_guard<std::mutex> lock(registryMutex());
+    registry().push_back(this);
+}
+
+BlockPool::~BlockPool() {
+    {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        auto& pools = registry();
+        pools.erase(std::remove(pools.begin(), pools.end(), this), pools.end());
+    }
+    for(void* block : free_) {
+        ::operator delete(block);
+    }
+}
+
+void* BlockPool::allocate(size_t size) {
+    if(size > block_size_) {
+        return ::operator new(size);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        peak_ = std::max(peak_, ++in_use_);
+        if(!free_.empty()) {
+            void* block = free_.back();
+            free_.pop_back();
+            ++reused_;
+            return block;
+        }
+        ++allocated_;
+    }
+
+    try {
+        return ::operator new(block_size_);
+    } catch(...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --in_use_;
+        --allocated_;
+        throw;
+    }
+}
+
+void BlockPool::deallocate(void* block, size_t size) noexcept {
+    if(size > block_size_) {
+        ::operator delete(block);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --in_use_;
+        if(free_.size() < max_free_) {
+            free_.push_back(block);
+            return;
+        }
+    }
+    ::operator delete(block);
+}
+
+BlockPool::Stats BlockPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return {name_, block_size_, in_use_, free_.size(), peak_, allocated_, reused_};
+}
+
+std::vector<BlockPool::Stats> BlockPool::all() {
+    std::lock_guard<std::mutex> lock(registryMutex());
+    std::vector<Stats> stats;
+    for(const BlockPool* pool : registry()) {
+        stats.push_back(pool->stats());
+    }
+    return stats;
+}
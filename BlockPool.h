@@ -0,0 +1,118 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Free list of fixed-size blocks for memory every connection needs (the
+// handler, its receive buffer, its session frame). Blocks given back on
+// disconnect go to the next connection instead of the heap; up to max_free
+// are kept. Requests larger than the block size fall through to the heap.
+// Thread-safe: a connection is set up on its shard, but the last reference
+// to it may be dropped by a dispatch worker.
+class BlockPool {
+  public:
+    struct Stats {
+        const char* name;
+        size_t block_size;
+        size_t in_use;
+        size_t free;
+        size_t peak;
+        // Blocks taken from the heap, and requests served from the free list.
+        uint64_t allocated;
+        uint64_t reused;
+    };
+
+    BlockPool(const char* name, size_t block_size, size_t max_free);
+    ~BlockPool();
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    void* allocate(size_t size);
+    // size must be the one passed to allocate().
+    void deallocate(void* block, size_t size) noexcept;
+
+    size_t blockSize() const {
+        return block_size_;
+    }
+    Stats stats() const;
+    // Every pool that currently exists, in creation order.
+    static std::vector<Stats> all();
+
+  private:
+    const char* name_;
+    size_t block_size_;
+    size_t max_free_;
+    mutable std::mutex mutex_;
+    std::vector<void*> free_;
+    size_t in_use_ = 0;
+    size_t peak_ = 0;
+    uint64_t allocated_ = 0;
+    uint64_t reused_ = 0;
+};
+
+// A fixed-size byte buffer taken from a BlockPool for its lifetime. The
+// bytes start out uninitialized.
+class PooledBuffer {
+  public:
+    PooledBuffer(BlockPool& pool, size_t size)
+        : pool_(&pool), data_(static_cast<char*>(pool.allocate(size))), size_(size) {}
+    ~PooledBuffer() {
+        pool_->deallocate(data_, size_);
+    }
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    char* data() {
+        return data_;
+    }
+    const char* data() const {
+        return data_;
+    }
+    size_t size() const {
+        return size_;
+    }
+    char operator[](size_t index) const {
+        return data_[index];
+    }
+
+  private:
+    BlockPool* pool_;
+    char* data_;
+    size_t size_;
+};
+
+// Hands a container, or std::allocate_shared, memory from a BlockPool.
+template <typename T>
+class PoolAllocator {
+  public:
+    using value_type = T;
+
+    explicit PoolAllocator(BlockPool& pool) noexcept : pool_(&pool) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) noexcept : pool_(other.pool_) {}
+
+    T* allocate(size_t count) {
+        static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "BlockPool blocks are not aligned enough");
+        return static_cast<T*>(pool_->allocate(count * sizeof(T)));
+    }
+    void deallocate(T* block, size_t count) noexcept {
+        pool_->deallocate(block, count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const noexcept {
+        return pool_ == other.pool_;
+    }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const noexcept {
+        return pool_ != other.pool_;
+    }
+
+  private:
+    template <typename U>
+    friend class PoolAllocator;
+
+    BlockPool* pool_;
+};
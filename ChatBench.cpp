@@ -0,0 +1,787 @@
+#include "BlockPool.h"
+#include "ChatServer.h"
+#include "ClientHandler.h"
+#include "Histogram.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "TimerWheel.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static std::atomic<size_t> g_allocations{0};
+
+void* operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = std::malloc(size ? size : 1);
+    if(!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// Socket calls made by the server, for the syscalls scenario. These shadow
+// the libc wrappers for everything linked into chat_bench and go straight
+// to the kernel; the benchmark's own peers use read() and write().
+static std::atomic<size_t> g_recv_calls{0};
+static std::atomic<size_t> g_sendmsg_calls{0};
+
+extern "C" ssize_t recv(int fd, void* buffer, size_t length, int flags) {
+    g_recv_calls.fetch_add(1, std::memory_order_relaxed);
+    return syscall(SYS_recvfrom, fd, buffer, length, flags, nullptr, nullptr);
+}
+
+extern "C" ssize_t sendmsg(int fd, const msghdr* msg, int flags) {
+    g_sendmsg_calls.fetch_add(1, std::memory_order_relaxed);
+    return syscall(SYS_sendmsg, fd, msg, flags);
+}
+
+namespace {
+
+class Options {
+  public:
+    Options(int argc, char* argv[], int first) {
+        for(int i = first; i < argc; ++i) {
+            std::string arg = argv[i];
+            if(arg.rfind("--", 0) != 0) continue;
+            size_t eq = arg.find('=');
+            if(eq == std::string::npos) {
+                values_[arg.substr(2)] = "1";
+            } else {
+                values_[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+            }
+        }
+    }
+
+    long get(const std::string& name, long fallback) const {
+        auto it = values_.find(name);
+        return it == values_.end() ? fallback : std::stol(it->second);
+    }
+
+    std::string getString(const std::string& name, const std::string& fallback) const {
+        auto it = values_.find(name);
+        return it == values_.end() ? fallback : it->second;
+    }
+
+  private:
+    std::map<std::string, std::string> values_;
+};
+
+// The scenarios measure the server, not the limits on how fast one client
+// may send; the unthreaded ones would not even run the throttle's timers.
+FloodConfig unlimited() {
+    FloodConfig config;
+    config.messages_per_sec = 0;
+    config.bytes_per_sec = 0;
+    return config;
+}
+
+void drainPeer(int fd) {
+    char buffer[65536];
+    while(read(fd, buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+// Broadcasts to in-process clients connected through socketpairs and counts
+// heap allocations made by ChatServer::broadcast alone.
+int runFanout(const Options& options) {
+    const long clients = options.get("clients", 1000);
+    const long broadcasts = options.get("broadcasts", 1000);
+
+    ChatServer server(0, 1);
+    server.runInline();
+    server.setFloodControl(unlimited());
+    std::vector<int> peers;
+    for(long i = 0; i < clients; ++i) {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) {
+            std::cerr << "socketpair failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        server.adoptClient(fds[0]);
+        peers.push_back(fds[1]);
+    }
+
+    const std::string message = "[bench] " + std::string(64, 'x');
+    size_t allocations = 0;
+    std::chrono::nanoseconds elapsed(0);
+
+    // Warm-up so per-client queues and the flush list reach steady-state capacity.
+    server.broadcast(message);
+    server.flushPending();
+    for(int fd : peers) drainPeer(fd);
+
+    for(long i = 0; i < broadcasts; ++i) {
+        size_t before = g_allocations.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        server.broadcast(message);
+        elapsed += std::chrono::steady_clock::now() - start;
+        allocations += g_allocations.load(std::memory_order_relaxed) - before;
+
+        server.flushPending();
+        for(int fd : peers) drainPeer(fd);
+    }
+
+    std::cout << "fanout: " << clients << " clients, " << broadcasts << " broadcasts\n"
+              << "  allocations per broadcast: "
+              << static_cast<double>(allocations) / broadcasts << "\n"
+              << "  ns per broadcast:          "
+              << elapsed.count() / broadcasts << "\n";
+
+    for(int fd : peers) close(fd);
+    return 0;
+}
+
+// Feeds chat lines through one client's receive path (recv, line framing,
+// parsing, dispatch and fan-out) and counts heap allocations once warmed up.
+// Exits non-zero if the steady state allocates.
+int runDispatch(const Options& options) {
+    const long clients = options.get("clients", 100);
+    const long messages = options.get("messages", 10000);
+    const long warmup = options.get("warmup", 10000);
+
+    ChatServer server(0, 1);
+    server.runInline();
+    server.setFloodControl(unlimited());
+    std::vector<std::shared_ptr<ClientHandler>> handlers;
+    std::vector<int> peers;
+    for(long i = 0; i < clients; ++i) {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) {
+            std::cerr << "socketpair failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        handlers.push_back(server.adoptClient(fds[0]));
+        peers.push_back(fds[1]);
+    }
+
+    const std::string line = "hello from the dispatch benchmark\n";
+    ClientHandler& sender = *handlers.front();
+    size_t allocations = 0;
+    std::chrono::nanoseconds elapsed(0);
+
+    for(long i = 0; i < warmup + messages; ++i) {
+        if(send(peers.front(), line.data(), line.size(), 0) < 0) {
+            std::cerr << "send failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+
+        size_t before = g_allocations.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        sender.onReadable();
+        auto end = std::chrono::steady_clock::now();
+        size_t after = g_allocations.load(std::memory_order_relaxed);
+
+        if(i >= warmup) {
+            allocations += after - before;
+            elapsed += end - start;
+        }
+
+        server.flushPending();
+        for(int fd : peers) drainPeer(fd);
+    }
+
+    std::cout << "dispatch: " << clients << " clients, " << messages << " messages\n"
+              << "  allocations per message:   "
+              << static_cast<double>(allocations) / messages << "\n"
+              << "  ns per message:            "
+              << elapsed.count() / messages << "\n";
+
+    for(int fd : peers) close(fd);
+    return allocations == 0 ? 0 : 1;
+}
+
+struct LoadClient {
+    int fd = -1;
+    std::string buffer;
+    std::string nick;
+    bool ready = false;
+};
+
+// Reads the simulated clients' sockets on its own thread. Chat lines that
+// carry a "bench <ns>" stamp are timed against the steady clock the sender
+// used; the first "Your nickname:" banner line marks a client as connected.
+class Receiver {
+  public:
+    explicit Receiver(std::atomic<size_t>& ready_count)
+        : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)), ready_count_(ready_count) {}
+
+    ~Receiver() {
+        stop();
+        close(epoll_fd_);
+    }
+
+    void add(LoadClient* client) {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = client;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client->fd, &ev);
+    }
+
+    void start() {
+        running_ = true;
+        thread_ = std::thread(&Receiver::run, this);
+    }
+
+    void stop() {
+        running_ = false;
+        if(thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    uint64_t delivered() const {
+        return delivered_;
+    }
+    const Histogram& latency() const {
+        return latency_;
+    }
+
+  private:
+    void run() {
+        epoll_event events[64];
+        while(running_) {
+            int ready = epoll_wait(epoll_fd_, events, 64, 50);
+            for(int i = 0; i < ready; ++i) {
+                onReadable(*static_cast<LoadClient*>(events[i].data.ptr));
+            }
+        }
+    }
+
+    void onReadable(LoadClient& client) {
+        char chunk[65536];
+        ssize_t received;
+        while((received = recv(client.fd, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0) {
+            client.buffer.append(chunk, static_cast<size_t>(received));
+        }
+
+        size_t start = 0;
+        size_t end;
+        while((end = client.buffer.find('\n', start)) != std::string::npos) {
+            onLine(client, std::string_view(client.buffer).substr(start, end - start));
+            start = end + 1;
+        }
+        client.buffer.erase(0, start);
+    }
+
+    void onLine(LoadClient& client, std::string_view line) {
+        if(!client.ready) {
+            static constexpr std::string_view kBanner = "Your nickname: ";
+            size_t pos = line.find(kBanner);
+            if(pos == std::string_view::npos) return;
+            std::string_view nick = line.substr(pos + kBanner.size());
+            client.nick = std::string(nick.substr(0, nick.find_first_of(" |")));
+            client.ready = true;
+            ready_count_.fetch_add(1, std::memory_order_release);
+            return;
+        }
+
+        // The sender's own "[PM to ...]" echo is not a fan-out delivery.
+        size_t pos = line.find("bench ");
+        if(pos == std::string_view::npos || line.find("[PM to ") != std::string_view::npos) return;
+
+        // History replayed on join (from the journal, too) carries stamps from earlier runs.
+        uint64_t sent = std::strtoull(line.data() + pos + 6, nullptr, 10);
+        if(sent < started_ns_) return;
+        uint64_t now = Metrics::nowNs();
+        latency_.record(now > sent ? now - sent : 0);
+        delivered_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    int epoll_fd_;
+    const uint64_t started_ns_ = Metrics::nowNs();
+    std::atomic<size_t>& ready_count_;
+    std::atomic<bool> running_{false};
+    std::atomic<uint64_t> delivered_{0};
+    Histogram latency_;
+    std::thread thread_;
+};
+
+std::map<std::string, double> readResults(const std::string& path) {
+    std::map<std::string, double> results;
+    std::ifstream in(path);
+    std::string key;
+    double value;
+    while(in >> key >> value) {
+        results[key] = value;
+    }
+    return results;
+}
+
+// Prints results, next to the matching --baseline values if given, and
+// writes them to --record for a later run to compare against.
+void report(const std::vector<std::pair<std::string, double>>& results, const Options& options) {
+    const std::string baseline_path = options.getString("baseline", "");
+    const std::string record_path = options.getString("record", "");
+    const std::map<std::string, double> baseline =
+        baseline_path.empty() ? std::map<std::string, double>() : readResults(baseline_path);
+
+    for(const auto& [key, value] : results) {
+        std::cout << "  " << std::left << std::setw(22) << key << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(12) << value;
+        auto it = baseline.find(key);
+        if(it != baseline.end() && it->second != 0) {
+            std::cout << "   (baseline " << it->second << ", " << std::showpos
+                      << (value - it->second) / it->second * 100.0 << std::noshowpos << "%)";
+        }
+        std::cout << "\n";
+    }
+
+    if(!record_path.empty()) {
+        std::ofstream out(record_path);
+        for(const auto& [key, value] : results) {
+            out << key << ' ' << value << '\n';
+        }
+    }
+}
+
+// Sends chat lines from one of N in-process clients, burst lines per event
+// loop turn, and counts the recv() and sendmsg() calls the server makes to
+// read them and deliver the results to every client.
+int runSyscalls(const Options& options) {
+    const long clients = options.get("clients", 100);
+    const long messages = options.get("messages", 1000);
+    const long burst = std::max(1L, options.get("burst", 1));
+
+    ChatServer server(0, 1);
+    server.runInline();
+    server.setFloodControl(unlimited());
+    std::vector<std::shared_ptr<ClientHandler>> handlers;
+    std::vector<int> peers;
+    for(long i = 0; i < clients; ++i) {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) {
+            std::cerr << "socketpair failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        handlers.push_back(server.adoptClient(fds[0]));
+        peers.push_back(fds[1]);
+    }
+    server.flushPending();
+    for(int fd : peers) drainPeer(fd);
+
+    std::string lines;
+    for(long i = 0; i < burst; ++i) {
+        lines += "hello from the syscall benchmark\n";
+    }
+    ClientHandler& sender = *handlers.front();
+    const long turns = std::max(1L, messages / burst);
+    size_t recv_calls = 0;
+    size_t sendmsg_calls = 0;
+
+    for(long i = 0; i < turns; ++i) {
+        if(write(peers.front(), lines.data(), lines.size()) < 0) {
+            std::cerr << "write failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+
+        size_t recv_before = g_recv_calls.load(std::memory_order_relaxed);
+        size_t sendmsg_before = g_sendmsg_calls.load(std::memory_order_relaxed);
+        sender.onReadable();
+        server.flushPending();
+        recv_calls += g_recv_calls.load(std::memory_order_relaxed) - recv_before;
+        sendmsg_calls += g_sendmsg_calls.load(std::memory_order_relaxed) - sendmsg_before;
+
+        for(int fd : peers) drainPeer(fd);
+    }
+
+    const double sent = static_cast<double>(turns * burst);
+    std::cout << "syscalls: " << clients << " clients, " << turns * burst << " messages, " << burst
+              << " per turn\n";
+    report({{"recv_per_message", recv_calls / sent},
+            {"sendmsg_per_message", sendmsg_calls / sent},
+            {"sendmsg_per_socket_turn", sendmsg_calls / static_cast<double>(turns * clients)}},
+           options);
+
+    for(int fd : peers) close(fd);
+    return 0;
+}
+
+// Connects --connections=N in-process clients one after another next to
+// --clients=M resident ones. Each leaves right away and is torn down, so
+// the whole lifetime of a connection is measured (handler, receive buffer,
+// session, goodbye, removal) without a broadcast to the resident clients. The first --warmup
+// connections are not counted.
+int runChurn(const Options& options) {
+    const long resident = options.get("clients", 100);
+    const long connections = options.get("connections", 10000);
+    const long warmup = options.get("warmup", 100);
+
+    ChatServer server(0, 1);
+    server.runInline();
+    server.setFloodControl(unlimited());
+    std::vector<int> peers;
+    for(long i = 0; i < resident; ++i) {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) {
+            std::cerr << "socketpair failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        server.adoptClient(fds[0]);
+        peers.push_back(fds[1]);
+    }
+
+    static const std::string_view lines = "/leave\n";
+    size_t allocations = 0;
+    std::chrono::nanoseconds elapsed(0);
+
+    for(long i = 0; i < warmup + connections; ++i) {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) {
+            std::cerr << "socketpair failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        if(write(fds[1], lines.data(), lines.size()) < 0) {
+            std::cerr << "write failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+
+        size_t before = g_allocations.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::shared_ptr<ClientHandler> client = server.adoptClient(fds[0]);
+            client->onReadable();
+        }
+        server.flushPending();
+        if(i >= warmup) {
+            elapsed += std::chrono::steady_clock::now() - start;
+            allocations += g_allocations.load(std::memory_order_relaxed) - before;
+        }
+
+        drainPeer(fds[1]);
+        close(fds[1]);
+        for(int fd : peers) drainPeer(fd);
+    }
+
+    std::cout << "churn: " << connections << " connections next to " << resident << " resident clients\n";
+    report({{"allocs_per_connection", static_cast<double>(allocations) / connections},
+            {"ns_per_connection", static_cast<double>(elapsed.count()) / connections}},
+           options);
+    // This shard never runs its timers, so the idle timers of closed
+    // clients keep their reference blocks.
+    for(const BlockPool::Stats& pool : BlockPool::all()) {
+        std::cout << "  pool " << std::left << std::setw(17) << pool.name << std::right << std::setw(8)
+                  << pool.in_use << " in use " << std::setw(6) << pool.free << " free " << std::setw(8)
+                  << pool.allocated << " from heap " << std::setw(8) << pool.reused << " reused\n";
+    }
+
+    for(int fd : peers) close(fd);
+    return 0;
+}
+
+// Schedules --timers=N timers spread over --spread=SECONDS on a timer wheel
+// and runs it on a simulated clock the way a shard does, sleeping for
+// timeoutMs() between advances. Reports the cost per timer and how often
+// the loop would have woken up.
+int runTimers(const Options& options) {
+    const long timers = options.get("timers", 50000);
+    const long spread_ms = std::max(1L, options.get("spread", 300) * 1000);
+    constexpr uint64_t kMs = TimerWheel::kTickNs;
+
+    std::mt19937_64 random(42);
+    std::vector<uint64_t> deadlines;
+    for(long i = 0; i < timers; ++i) {
+        deadlines.push_back(random() % static_cast<uint64_t>(spread_ms * 1000000));
+    }
+
+    TimerWheel wheel(0);
+    // Captured by pointer so the callbacks fit in std::function's inline
+    // storage, as the server's own (a client pointer) do.
+    struct {
+        size_t fired = 0;
+        uint64_t late_ns = 0;
+        uint64_t now = 0;
+    } state;
+
+    size_t allocations_before = g_allocations.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t deadline : deadlines) {
+        wheel.schedule(deadline, [&state, deadline] {
+            ++state.fired;
+            state.late_ns += state.now - deadline;
+        });
+    }
+    const auto scheduled = std::chrono::steady_clock::now() - start;
+    const size_t allocations = g_allocations.load(std::memory_order_relaxed) - allocations_before;
+
+    size_t wakeups = 0;
+    start = std::chrono::steady_clock::now();
+    while(true) {
+        int timeout = wheel.timeoutMs(state.now);
+        if(timeout < 0) break;
+        state.now += std::max(timeout, 1) * kMs;
+        wheel.advance(state.now);
+        ++wakeups;
+    }
+    const auto ran = std::chrono::steady_clock::now() - start;
+
+    std::cout << "timers: " << timers << " timers over " << spread_ms / 1000 << " s, " << state.fired << " fired\n";
+    report({{"ns_per_schedule", std::chrono::duration<double, std::nano>(scheduled).count() / timers},
+            {"ns_per_fire", std::chrono::duration<double, std::nano>(ran).count() / timers},
+            {"allocs_per_timer", static_cast<double>(allocations) / timers},
+            {"wakeups", static_cast<double>(wakeups)},
+            {"mean_late_us", static_cast<double>(state.late_ns) / timers / 1000.0}},
+           options);
+    return state.fired == static_cast<size_t>(timers) ? 0 : 1;
+}
+
+// Drives a live server over loopback: connects the simulated clients, then
+// sends a broadcast / PM / nick / users mix at a fixed rate (open loop) and
+// reports throughput and end-to-end delivery latency. Results can be
+// written with --record and compared against a file given as --baseline.
+int runLoad(const Options& options) {
+    const long clients = options.get("clients", 50);
+    const long rate = options.get("rate", 500);
+    const long seconds = options.get("seconds", 5);
+    const long receivers = std::max(1L, options.get("threads", 2));
+    const int port = static_cast<int>(options.get("port", 56000));
+    const bool external = options.get("connect", 0) != 0;
+
+    long mix[4] = {70, 20, 5, 5};
+    {
+        std::istringstream in(options.getString("mix", "70,20,5,5"));
+        std::string part;
+        for(int i = 0; i < 4 && std::getline(in, part, ','); ++i) {
+            mix[i] = std::stol(part);
+        }
+    }
+    const long mix_total = mix[0] + mix[1] + mix[2] + mix[3];
+    if(clients < 2 || rate <= 0 || mix_total <= 0) {
+        std::cerr << "load: need --clients >= 2, --rate > 0 and a non-zero --mix" << std::endl;
+        return 1;
+    }
+
+    IoBackendKind io_backend = IoBackendKind::Epoll;
+    if(!parseIoBackend(options.getString("backend", "epoll"), io_backend)) {
+        std::cerr << "load: --backend must be epoll, io_uring or auto" << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<ChatServer> server;
+    if(!external) {
+        server = std::make_unique<ChatServer>(port, static_cast<size_t>(options.get("shards", 0)), io_backend);
+        server->setWorkers(static_cast<size_t>(options.get("workers", 0)));
+        server->setFloodControl(unlimited());
+        server->start();
+    }
+
+    auto finish = [&](int code) {
+        if(server) {
+            server->stop();
+        }
+        return code;
+    };
+
+    std::atomic<size_t> ready_count{0};
+    std::vector<std::unique_ptr<Receiver>> readers;
+    for(long i = 0; i < receivers; ++i) {
+        readers.push_back(std::make_unique<Receiver>(ready_count));
+        readers.back()->start();
+    }
+
+    std::vector<LoadClient> pool(clients);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    const auto connect_start = std::chrono::steady_clock::now();
+    for(long i = 0; i < clients; ++i) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            std::cerr << "connect failed: " << strerror(errno) << std::endl;
+            if(fd >= 0) close(fd);
+            readers.clear();
+            for(auto& client : pool) {
+                if(client.fd >= 0) close(client.fd);
+            }
+            return finish(1);
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pool[i].fd = fd;
+        readers[i % receivers]->add(&pool[i]);
+    }
+    while(ready_count.load(std::memory_order_acquire) < static_cast<size_t>(clients)) {
+        if(std::chrono::steady_clock::now() - connect_start > std::chrono::seconds(30)) {
+            std::cerr << "load: timed out waiting for welcome banners" << std::endl;
+            readers.clear();
+            for(auto& client : pool) close(client.fd);
+            return finish(1);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const double connect_seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - connect_start).count();
+
+    std::vector<std::string> nicks;
+    for(const auto& client : pool) {
+        nicks.push_back(client.nick);
+    }
+
+    std::mt19937 rng(42);
+    uint64_t sent[4] = {0, 0, 0, 0};
+    uint64_t renames = 0;
+    std::string line;
+    const auto interval = std::chrono::nanoseconds(1000000000L / rate);
+    const auto send_start = std::chrono::steady_clock::now();
+    const auto deadline = send_start + std::chrono::seconds(seconds);
+    auto next = send_start;
+
+    while(next < deadline) {
+        std::this_thread::sleep_until(next);
+        next += interval;
+
+        size_t from = rng() % clients;
+        long pick = static_cast<long>(rng() % mix_total);
+        int op = pick < mix[0] ? 0 : pick < mix[0] + mix[1] ? 1 : pick < mix[0] + mix[1] + mix[2] ? 2 : 3;
+
+        switch(op) {
+        case 0:
+            line = "bench " + std::to_string(Metrics::nowNs()) + "\n";
+            break;
+        case 1: {
+            size_t to = (from + 1 + rng() % (clients - 1)) % clients;
+            line = "/pm " + nicks[to] + " bench " + std::to_string(Metrics::nowNs()) + "\n";
+            break;
+        }
+        case 2:
+            nicks[from] = "b" + std::to_string(from) + "_" + std::to_string(++renames);
+            line = "/nick " + nicks[from] + "\n";
+            break;
+        default:
+            line = "/users\n";
+        }
+
+        if(send(pool[from].fd, line.data(), line.size(), MSG_NOSIGNAL) < 0) {
+            std::cerr << "send failed: " << strerror(errno) << std::endl;
+            break;
+        }
+        ++sent[op];
+    }
+    const double send_seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - send_start).count();
+
+    // Let in-flight deliveries land: stop once nothing arrived for 500 ms.
+    uint64_t last = 0;
+    auto quiet_since = std::chrono::steady_clock::now();
+    while(std::chrono::steady_clock::now() - quiet_since < std::chrono::milliseconds(500)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        uint64_t delivered = 0;
+        for(auto& reader : readers) delivered += reader->delivered();
+        if(delivered != last) {
+            last = delivered;
+            quiet_since = std::chrono::steady_clock::now();
+        }
+    }
+
+    Histogram latency;
+    for(auto& reader : readers) {
+        reader->stop();
+        latency.merge(reader->latency());
+    }
+    readers.clear();
+    for(auto& client : pool) close(client.fd);
+    finish(0);
+
+    const uint64_t total_sent = sent[0] + sent[1] + sent[2] + sent[3];
+    const std::vector<std::pair<std::string, double>> results = {
+        {"connections_per_sec", clients / connect_seconds},
+        {"sent_per_sec", total_sent / send_seconds},
+        {"delivered_per_sec", latency.count() / send_seconds},
+        {"p50_us", latency.percentile(50) / 1000.0},
+        {"p99_us", latency.percentile(99) / 1000.0},
+        {"p999_us", latency.percentile(99.9) / 1000.0},
+        {"max_us", latency.max() / 1000.0},
+    };
+    std::cout << "load: " << clients << " clients, target " << rate << " msg/s for " << seconds << " s ("
+              << sent[0] << " broadcast, " << sent[1] << " pm, " << sent[2] << " nick, "
+              << sent[3] << " users)";
+    if(server) {
+        std::cout << " on " << server->ioBackend() << ", "
+                  << (server->workers() ? std::to_string(server->workers()->size()) + " worker(s)" : "no workers");
+    }
+    std::cout << "\n";
+    report(results, options);
+    return 0;
+}
+
+void usage() {
+    std::cerr << "Usage: chat_bench <scenario> [--option=value ...]\n"
+              << "Scenarios:\n"
+              << "  fanout   --clients=N --broadcasts=N\n"
+              << "  dispatch --clients=N --messages=N --warmup=N\n"
+              << "  syscalls --clients=N --messages=N --burst=LINES_PER_TURN [--record=FILE] [--baseline=FILE]\n"
+              << "  churn    --clients=N --connections=N --warmup=N [--record=FILE] [--baseline=FILE]\n"
+              << "  timers   --timers=N --spread=SECONDS [--record=FILE] [--baseline=FILE]\n"
+              << "  load     --clients=N --rate=MSGS_PER_SEC --seconds=N --mix=BCAST,PM,NICK,USERS\n"
+              << "           [--threads=N] [--shards=N] [--backend=epoll|io_uring|auto] [--workers=N]\n"
+              << "           [--port=N] [--connect=1] [--record=FILE] [--baseline=FILE]\n";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 2) {
+        usage();
+        return 1;
+    }
+
+    const std::string scenario = argv[1];
+    Options options(argc, argv, 2);
+    // Keep per-connection server chatter out of the results; warnings
+    // (dropped messages, send errors) still show.
+    Log::setLevel(LogLevel::Warn);
+
+    if(scenario == "fanout") {
+        return runFanout(options);
+    }
+    if(scenario == "dispatch") {
+        return runDispatch(options);
+    }
+    if(scenario == "load") {
+        return runLoad(options);
+    }
+    if(scenario == "syscalls") {
+        return runSyscalls(options);
+    }
+    if(scenario == "churn") {
+        return runChurn(options);
+    }
+    if(scenario == "timers") {
+        return runTimers(options);
+    }
+
+    usage();
+    return 1;
+}
@@ -1,5 +1,8 @@
 #include "ChatServer.h"
+#include "BlockPool.h"
 #include "ClientHandler.h"
+#include "Log.h"
+#include "Metrics.h"
 #include <arpa/inet.h>
 #include <iostream>
 #include <netinet/in.h>
@@ -9,110 +12,114 @@
 #include <netinet/tcp.h>
 #include <cstring>
 #include <algorithm>
+#include <charconv>
 #include <iomanip>
 #include <ctime>
 #include <chrono>
 #include <sstream>
-#include <fcntl.h>
+#include <fstream>
+#include <cstdlib>
+#include <cstdio>
+
+static LoggerOptions makeLoggerOptions() {
+    LoggerOptions options;
+    options.async = true;
+    options.flush_interval = std::chrono::milliseconds(200);
+    return options;
+}
 
-ChatServer::ChatServer(int port)
-    : port_(port), server_socket_(-1), running_(false), logger_("log.txt") {}
+ChatServer::ChatServer(int port, size_t shard_count, IoBackendKind io_backend)
+    : port_(port), running_(false), history_(kHistoryMessages, kHistoryBytes),
+      logger_("log.txt", makeLoggerOptions()) {
+    if(const char* password = std::getenv("CHAT_ADMIN_PASSWORD")) {
+        admin_password_ = password;
+    }
+    if(shard_count == 0) {
+        shard_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if(io_backend == IoBackendKind::IoUring && !IoBackend::uringUnsupported().empty()) {
+        Log::warn("io_uring unavailable (", IoBackend::uringUnsupported(), "), falling back to epoll");
+    }
+    for(size_t i = 0; i < shard_count; ++i) {
+        shards_.push_back(std::make_unique<Shard>(this, i, io_backend));
+    }
+}
 
 ChatServer::~ChatServer() {
     stop();
 }
 
 std::string getTimestamp() {
-    auto now = std::chrono::system_clock::now();
-    auto in_time_t = std::chrono::system_clock::to_time_t(now);
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                  now.time_since_epoch()) % 1000;
+    return std::string(Log::timestamp());
+}
 
-    std::tm bt = *std::localtime(&in_time_t);
+static void appendTimestamp(std::string& out) {
+    out.append(Log::timestamp());
+}
 
-    std::ostringstream oss;
-    oss << std::put_time(&bt, "%Y-%m-%d %H:%M:%S");
-    oss << '.' << std::setfill('0') << std::setw(3) << ms.count();
-    return oss.str();
+// Formatting buffers reused by every dispatch on this thread. clear() keeps
+// their capacity, so once warmed up, formatting a message does not allocate.
+static std::string& scratch(size_t index) {
+    thread_local std::string buffers[2];
+    buffers[index].clear();
+    return buffers[index];
 }
 
 void ChatServer::start() {
-    server_socket_ = socket(AF_INET, SOCK_STREAM, 0);
-    if(server_socket_ < 0) {
-        throw std::runtime_error("Socket creation failed");
+    for(auto& shard : shards_) {
+        shard->listen(port_);
     }
 
-    int flags = fcntl(server_socket_, F_GETFL, 0);
-    if(flags < 0) {
-        close(server_socket_);
-        throw std::runtime_error("fcntl(F_GETFL) failed");
-    }
-    if(fcntl(server_socket_, F_SETFL, flags | O_NONBLOCK) < 0) {
-        close(server_socket_);
-        throw std::runtime_error("fcntl(F_SETFL) failed");
+    if(!journal_path_.empty()) {
+        try {
+            journal_ = std::make_unique<Journal>(journal_path_, Journal::kSegmentBytes, journal_segments_);
+            restoreHistory();
+        } catch(const std::exception& e) {
+            Log::error("Journal disabled: ", e.what());
+            journal_.reset();
+        }
     }
 
-    int opt = 1;
-    if(setsockopt(server_socket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        close(server_socket_);
-        throw std::runtime_error("setsockopt failed");
+    if(worker_count_ > 0) {
+        workers_ = std::make_unique<WorkerPool>(worker_count_);
     }
 
-    sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port_);
-
-    if(bind(server_socket_, (sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        close(server_socket_);
-        throw std::runtime_error("Bind failed");
+    running_ = true;
+    started_at_ = std::chrono::steady_clock::now();
+    for(auto& shard : shards_) {
+        shard->start();
     }
-
-    if(listen(server_socket_, 5) < 0) {
-        close(server_socket_);
-        throw std::runtime_error("Listen failed");
+    if(stats_interval_.count() > 0) {
+        stats_thread_ = std::thread(&ChatServer::dumpStats, this);
     }
-
-    running_ = true;
-    main_thread_ = std::make_unique<std::thread>(&ChatServer::run, this);
-    logger_.log("[" + getTimestamp() + "] Server started on port " + std::to_string(port_));
+    Log::info("Started ", shards_.size(), " reactor shard(s) on ", ioBackend(), ", ",
+              workers_ ? std::to_string(workers_->size()) + " dispatch worker(s)" : "dispatching on the shards");
+    logger_.log("[" + getTimestamp() + "] Server started on port " + std::to_string(port_) +
+                " with " + std::to_string(shards_.size()) + " shard(s) on " + ioBackend());
 }
 
-void ChatServer::stopClients() {
-    std::vector<std::shared_ptr<ClientHandler>> clients_copy;
-    {
-        std::lock_guard<std::mutex> lock(clients_mutex_);
-        clients_copy = {clients_.begin(), clients_.end()};
+void ChatServer::runInline() {
+    for(auto& shard : shards_) {
+        shard->runInline();
     }
+}
 
-    for(auto& client : clients_copy) {
-        client->sendMessage("\033[1;36m[System] Server is shutting down. Disconnecting...\033[0m");
-        client->stopClient();
+void ChatServer::stopClients() {
+    auto snapshot = registry_.snapshot();
+    for(const auto& entry : *snapshot) {
+        if(auto client = entry.client.lock()) {
+            client->sendMessage("\033[1;36m[System] Server is shutting down. Disconnecting...\033[0m");
+            client->stopClient();
+        }
     }
 
-    {
-        std::lock_guard<std::mutex> lock(clients_mutex_);
-        clients_.clear();
-        nicknames_.clear();
-    }
+    registry_.clear();
+    nick_allocator_.reset();
 }
 
 void ChatServer::removeClient(ClientHandler* client) {
-    std::lock_guard<std::mutex> lock(clients_mutex_);
-
-    auto nick_it = nicknames_.find(client->getNickname());
-    if(nick_it != nicknames_.end() && nick_it->second.get() == client) {
-        nicknames_.erase(nick_it);
-    }
-
-    for(auto it = clients_.begin(); it != clients_.end();) {
-        if(it->get() == client) {
-            it = clients_.erase(it);
-            break;
-        } else {
-            ++it;
-        }
+    if(registry_.remove(client->getNickname(), client)) {
+        nick_allocator_.release(client->getNickname());
     }
 }
 
@@ -121,162 +128,140 @@ void ChatServer::stop() {
 
     running_ = false;
 
+    // The goodbye notices are queued on each client's shard before the
+    // shards are told to stop; a stopping shard runs until its clients have
+    // read them or the shutdown timeout passes.
+    stopClients();
 
-    if(server_socket_ != -1) {
-        close(server_socket_);
-        server_socket_ = -1;
+    for(auto& shard : shards_) {
+        shard->stop();
+    }
+    for(auto& shard : shards_) {
+        shard->join();
+    }
+    // The workers run until the shards are done: a client whose messages a
+    // worker holds is only removed once the worker lets go of it. What is
+    // still queued for them is dropped, as the server is no longer running.
+    if(workers_) {
+        workers_->stop();
     }
-
-    stopClients();
 
     {
-        std::lock_guard<std::mutex> lock(clients_mutex_);
-        clients_.clear();
-        nicknames_.clear();
+        std::lock_guard<std::mutex> lock(stats_mutex_);
     }
-
-    if(main_thread_ && main_thread_->joinable()) {
-        main_thread_->join();
+    stats_wake_.notify_one();
+    if(stats_thread_.joinable()) {
+        stats_thread_.join();
     }
-}
 
-void ChatServer::run() {
-    std::cout << "[" << getTimestamp() << "] Server main thread started" << std::endl;
-    logger_.log("[" + getTimestamp() + "] Server main thread started");
+    registry_.clear();
+    history_.clear();
+    journal_.reset();
 
-    fd_set read_fds;
-    struct timeval timeout;
+    logger_.shutdown();
+}
 
-    while(running_) {
-        processScheduledRemovals();
+void ChatServer::acceptClient(Shard& shard, int client_socket) {
+    if(client_socket < 0) {
+        logger_.log("[" + getTimestamp() + "] Accept failed: " + std::string(strerror(-client_socket)));
+        Log::error("accept() failed: ", strerror(-client_socket));
+        return;
+    }
+    if(!running_) {
+        close(client_socket);
+        return;
+    }
 
-        FD_ZERO(&read_fds);
-        FD_SET(server_socket_, &read_fds);
+    // Output is already coalesced into one sendmsg() per socket and
+    // loop turn; Nagle would only hold it back for the peer's delayed ACK.
+    int one = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+    sockaddr_in client_addr;
+    memset(&client_addr, 0, sizeof(client_addr));
+    socklen_t client_len = sizeof(client_addr);
+    getpeername(client_socket, (sockaddr*)&client_addr, &client_len);
 
-        int ready = select(server_socket_ + 1, &read_fds, nullptr, nullptr, &timeout);
+    char client_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+    int client_port = ntohs(client_addr.sin_port);
 
-        if(!running_) break;
+    Log::info("New client connected: ", client_ip, ':', client_port,
+              " (socket: ", client_socket, ", shard: ", shard.index(), ')');
 
-        if(ready < 0) {
-            if(errno == EINTR) {
-                continue;
-            }
-            logger_.log("[" + getTimestamp() + "] Select error: " + std::string(strerror(errno)));
-            std::cerr << "[" << getTimestamp() << "] [ERROR] select() failed: "
-                      << strerror(errno) << std::endl;
-            continue;
-        }
+    std::shared_ptr<ClientHandler> client;
+    try {
+        client = adoptClient(client_socket, shard.index());
+    } catch(const std::exception& e) {
+        Log::error(e.what());
+        return;
+    }
 
-        if(ready == 0) {
-            continue;
+    const std::string nickname = client->getNickname();
+    const int totalWidth = 40;
+    const int prefixLen = 18;
+    const int suffixLen = 0;
+    const int spacesNeeded = totalWidth - prefixLen - nickname.length() - suffixLen;
+
+    std::string nickLine = "| Your nickname: " + nickname;
+    if(spacesNeeded > 0) {
+        nickLine += std::string(spacesNeeded, ' ');
+    }
+    nickLine += "|";
+
+    // The banner goes out as a single payload.
+    client->sendMessage(Payload::build([&](std::string& out) {
+        for(std::string_view line : {std::string_view("----------------------------------------"),
+                                     std::string_view("| Welcome to the chat server!          |"),
+                                     std::string_view(nickLine),
+                                     std::string_view("| Use /nick <new_nick> to change nick  |"),
+                                     std::string_view("| Use /pm <nick> <message> for PM      |"),
+                                     std::string_view("| Use /users to list online users      |"),
+                                     std::string_view("| Use /join <room> to enter a room     |"),
+                                     std::string_view("| Use /part to leave the current room  |"),
+                                     std::string_view("| Use /history [n] for recent messages |"),
+                                     std::string_view("| Use /leave to exit the chat          |"),
+                                     std::string_view("----------------------------------------")}) {
+            out += '\r';
+            out.append(line);
+            out += '\n';
         }
+    }));
+    replayHistory(client.get(), history_, kHistoryOnJoin);
 
-        if(FD_ISSET(server_socket_, &read_fds)) {
-            sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            int client_socket = accept(server_socket_, (sockaddr*)&client_addr, &client_len);
-
-            if(!running_) {
-                if(client_socket != -1) close(client_socket);
-                break;
-            }
-
-            if(client_socket < 0) {
-                if(running_) {
-                    logger_.log("[" + getTimestamp() + "] Accept failed: " + std::string(strerror(errno)));
-                    std::cerr << "[" << getTimestamp() << "] [ERROR] accept() failed: "
-                              << strerror(errno) << std::endl;
-                }
-                continue;
-            }
-
-            if(client_socket >= 0) {
-                char client_ip[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-                int client_port = ntohs(client_addr.sin_port);
-
-                std::cout << "[" << getTimestamp() << "] New client connected: "
-                          << client_ip << ":" << client_port
-                          << " (socket: " << client_socket << ")" << std::endl;
-            }
+    std::string sys_msg = "\033[1;36m[System] " + client->getNickname() + " joined\033[0m";
+    broadcast(sys_msg, nullptr);
 
-            int userNumber = getNextAvailableUserNumber();
-            std::string defaultNick = "User" + std::to_string(userNumber);
-            auto client = std::make_shared<ClientHandler>(client_socket, this, defaultNick);
-
-            bool clientExists = false;
-            {
-                std::lock_guard<std::mutex> lock(clients_mutex_);
-                for(const auto& existing : clients_) {
-                    if(existing->getSocket() == client_socket) {
-                        clientExists = true;
-                        break;
-                    }
-                }
+    logger_.log("[" + getTimestamp() + "] Client connected: " + std::string(client_ip) + ":" + std::to_string(client_port));
+}
 
-                if(!clientExists) {
-                    clients_.insert(client);
-                    nicknames_[client->getNickname()] = client;
-                }
-            }
+std::shared_ptr<ClientHandler> ChatServer::adoptClient(int socket, size_t shard) {
+    Shard& owner = *shards_.at(shard);
+    auto client = ClientHandler::create(socket, this, &owner, nick_allocator_.acquire());
+    Metrics::add(Metrics::Counter::Accepts);
 
-            if(clientExists) {
-                std::cerr << "[" << getTimestamp() << "] Client already exists: "
-                          << client_socket << std::endl;
-                close(client_socket);
-            } else {
-                client->start();
-                const std::string nickname = client->getNickname();
-                const int totalWidth = 40;
-                const int prefixLen = 18;
-                const int suffixLen = 0;
-                const int spacesNeeded = totalWidth - prefixLen - nickname.length() - suffixLen;
-
-                std::string nickLine = "| Your nickname: " + nickname;
-                if(spacesNeeded > 0) {
-                    nickLine += std::string(spacesNeeded, ' ');
-                }
-                nickLine += "|";
-
-                client->sendMessage("----------------------------------------");
-                client->sendMessage("| Welcome to the chat server!          |");
-                client->sendMessage(nickLine);
-                client->sendMessage("| Use /nick <new_nick> to change nick  |");
-                client->sendMessage("| Use /pm <nick> <message> for PM      |");
-                client->sendMessage("| Use /users to list online users      |");
-                client->sendMessage("| Use /leave to exit the chat          |");
-                client->sendMessage("----------------------------------------");
-
-                std::string sys_msg = "\033[1;36m[System] " + client->getNickname() + " joined\033[0m";
-                broadcast(sys_msg, nullptr);
-
-                char client_ip[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-                logger_.log("[" + getTimestamp() + "] Client connected: " + std::string(client_ip) + ":" + std::to_string(ntohs(client_addr.sin_port)));
-            }
-        }
+    owner.attach(client);
+    // A /nick to the same "UserN" may land between acquire() and the
+    // insert; that number stays marked as used and the next one is tried.
+    while(!addClient(client)) {
+        client->setNickname(nick_allocator_.acquire());
     }
-
-    stopClients();
-
-    processScheduledRemovals();
-
-    logger_.log("[" + getTimestamp() + "] Server main thread stopped");
-    std::cout << "[" << getTimestamp() << "] Server main thread stopped" << std::endl;
+    return client;
 }
 
-
-void ChatServer::addClient(std::shared_ptr<ClientHandler> client) {
-    std::lock_guard<std::mutex> lock(clients_mutex_);
-    clients_.insert(client);
-    nicknames_[client->getNickname()] = client;
+bool ChatServer::addClient(std::shared_ptr<ClientHandler> client) {
+    const std::string& nickname = client->getNickname();
+    if(!registry_.add(nickname, client)) return false;
+    nick_allocator_.claim(nickname);
+    return true;
 }
 
 void ChatServer::clientDisconnected(ClientHandler* client) {
+    Metrics::add(Metrics::Counter::Disconnects);
     removeClient(client);
+    for(const auto& room : client->getRooms()) {
+        rooms_.part(room, client);
+    }
 
     if(running_) {
         std::string sys_msg = "\033[1;36m[System] " + client->getNickname() + " left the chat\033[0m";
@@ -285,37 +270,50 @@ void ChatServer::clientDisconnected(ClientHandler* client) {
     }
 }
 
-void ChatServer::processMessage(ClientHandler* sender, const Message& msg) {
+void ChatServer::processMessage(ClientHandler* sender, const MessageView& msg) {
+    Metrics::message(msg.getType());
+
     switch(msg.getType()) {
     case MessageType::Broadcast: {
-        std::string formatted = "[" + sender->getNickname() + "] " + msg.getContent();
-        std::cout << "[" << getTimestamp() << "] [BROADCAST] Sending: " << formatted << std::endl;
-        broadcast(formatted, sender);
-        logger_.log("[" + getTimestamp() + "] BROADCAST: " + formatted);
+        std::string& formatted = scratch(0);
+        formatted += '[';
+        formatted += sender->getNickname();
+        formatted += "] ";
+        formatted += msg.getContent();
+        broadcast(msg, formatted, sender);
+
+        std::string& entry = scratch(1);
+        entry += '[';
+        appendTimestamp(entry);
+        entry += "] BROADCAST: ";
+        entry += formatted;
+        logger_.log(entry);
         break;
     }
     case MessageType::Private: {
-        std::string receiver = msg.getReceiver();
-        auto it = nicknames_.find(receiver);
+        std::string receiver(msg.getReceiver());
+        std::shared_ptr<ClientHandler> target = registry_.find(receiver);
 
-        if(it != nicknames_.end()) {
-            std::string to_receiver = "\033[1;35m[PM from " + sender->getNickname() + "]\033[0m " + msg.getContent();
-            std::string to_sender = "\033[1;35m[PM to " + receiver + "]\033[0m " + msg.getContent();
+        if(target) {
+            std::string to_receiver = "\033[1;35m[PM from " + sender->getNickname() + "]\033[0m ";
+            to_receiver += msg.getContent();
+            std::string to_sender = "\033[1;35m[PM to " + receiver + "]\033[0m ";
+            to_sender += msg.getContent();
 
-            it->second->sendMessage(to_receiver);
-            sender->sendMessage(to_sender);
+            target->sendMessage(msg, to_receiver);
+            sender->sendMessage(msg, to_sender);
             logger_.log("[" + getTimestamp() + "] PRIVATE: " + to_sender);
         } else {
             std::string error_msg = "\033[1;31m[System] Error: User '" + receiver + "' not found\033[0m";
             error_msg += "\n\033[1;36mAvailable users: ";
 
-            std::lock_guard<std::mutex> lock(clients_mutex_);
-            for(const auto& [nick, _] : nicknames_) {
-                if(nick != sender->getNickname()) {
-                    error_msg += nick + ", ";
+            auto snapshot = registry_.snapshot();
+            for(const auto& entry : *snapshot) {
+                if(entry.nickname != sender->getNickname()) {
+                    error_msg += entry.nickname + ", ";
                 }
             }
-            if(!nicknames_.empty()) {
+            if(!snapshot->empty()) {
                 error_msg.pop_back();
                 error_msg.pop_back();
             }
@@ -328,59 +326,105 @@ void ChatServer::processMessage(ClientHandler* sender, const Message& msg) {
     }
 
     case MessageType::NickChange: {
-        std::cout << "\n--- NICK CHANGE REQUEST ---\n";
-        std::cout << "From: " << sender->getNickname() << "\n";
-        std::cout << "Requested nick: " << msg.getContent() << "\n";
-        sender->debugInfo();
-
         std::string old_nick = sender->getNickname();
-        std::string new_nick = msg.getContent();
+        std::string new_nick(msg.getContent());
 
-        {
-            std::lock_guard<std::mutex> lock(clients_mutex_);
-            if(nicknames_.find(new_nick) != nicknames_.end() && new_nick != old_nick) {
-                sender->sendMessage("\033[1;31m[System] Error: Nickname '" + new_nick + "' is already taken\033[0m");
-                return;
-            }
+        if(!registry_.rename(old_nick, new_nick, sender->shared_from_this())) {
+            sender->sendMessage("\033[1;31m[System] Error: Nickname '" + new_nick + "' is already taken\033[0m");
+            return;
         }
 
-        std::shared_ptr<ClientHandler> clientPtr;
-        {
-            std::lock_guard<std::mutex> lock(clients_mutex_);
-            for(auto& client : clients_) {
-                if(client.get() == sender) {
-                    clientPtr = client;
-                    break;
-                }
-            }
-        }
+        nick_allocator_.release(old_nick);
+        nick_allocator_.claim(new_nick);
+        sender->setNickname(new_nick);
 
-        if(clientPtr) {
+        std::string sys_msg = "\033[1;36m[System] " + old_nick +
+                              " changed name to\033[0m \033[1;33m" + new_nick + "\033[0m";
+        broadcast(sys_msg, nullptr);
 
-            {
-                std::lock_guard<std::mutex> lock(clients_mutex_);
-                nicknames_.erase(old_nick);
-                nicknames_[new_nick] = clientPtr;
-            }
+        logger_.log("[" + getTimestamp() + "] NICK CHANGE: " + old_nick + " -> " + new_nick);
+        Log::debug("Nick change completed: ", old_nick, " -> ", new_nick);
+        break;
+    }
 
-            sender->setNickname(new_nick);
+    case MessageType::Join: {
+        std::string room;
+        if(!RoomTable::normalize(msg.getContent(), room)) {
+            sender->sendMessage("\033[1;31m[System] Error: Room names are 1-20 letters, digits, '-' or '_'\033[0m");
+            break;
+        }
 
-            std::string sys_msg = "\033[1;36m[System] " + old_nick +
-                                  " changed name to\033[0m \033[1;33m" + new_nick + "\033[0m";
-            broadcast(sys_msg, nullptr);
+        size_t members = rooms_.join(room, sender->shared_from_this());
+        sender->enterRoom(room);
+        if(members == 0) {
+            sender->sendMessage("\033[1;36m[System] Now talking in #" + room + "\033[0m");
+            break;
+        }
 
+        roomcast(room, "\033[1;36m[System] " + sender->getNickname() + " joined #" + room + "\033[0m", sender);
+        sender->sendMessage("\033[1;36m[System] You joined #" + room + " (" + std::to_string(members) +
+                            (members == 1 ? " member" : " members") +
+                            "). Use /all <message> to talk to everyone.\033[0m");
+        logger_.log("[" + getTimestamp() + "] ROOM JOIN: " + sender->getNickname() + " -> #" + room);
+        break;
+    }
 
-            logger_.log("[" + getTimestamp() + "] NICK CHANGE: " + old_nick + " -> " + new_nick);
+    case MessageType::Part: {
+        std::string room;
+        if(msg.getContent().empty()) {
+            room = sender->getActiveRoom();
+        } else if(!RoomTable::normalize(msg.getContent(), room)) {
+            sender->sendMessage("\033[1;31m[System] Error: Invalid room name\033[0m");
+            break;
+        }
 
+        if(room.empty() || !rooms_.part(room, sender)) {
+            sender->sendMessage(room.empty() ? "\033[1;31m[System] Error: You are not in any room\033[0m"
+                                             : "\033[1;31m[System] Error: You are not in #" + room + "\033[0m");
+            break;
+        }
+        sender->leaveRoom(room);
+
+        roomcast(room, "\033[1;36m[System] " + sender->getNickname() + " left #" + room + "\033[0m", nullptr);
+        const std::string& active = sender->getActiveRoom();
+        sender->sendMessage("\033[1;36m[System] You left #" + room + ". Now talking in " +
+                            (active.empty() ? std::string("the global chat") : "#" + active) + "\033[0m");
+        logger_.log("[" + getTimestamp() + "] ROOM PART: " + sender->getNickname() + " <- #" + room);
+        break;
+    }
 
+    case MessageType::RoomMessage: {
+        std::string room;
+        const auto& joined = sender->getRooms();
+        if(!RoomTable::normalize(msg.getReceiver(), room) ||
+           std::find(joined.begin(), joined.end(), room) == joined.end()) {
+            sender->sendMessage("\033[1;31m[System] Error: You are not in #" + std::string(msg.getReceiver()) + "\033[0m");
+            break;
         }
-        std::cout << "Nick change completed: " << old_nick << " -> " << new_nick << "\n";
+
+        std::string& formatted = scratch(0);
+        formatted += "[#";
+        formatted += room;
+        formatted += "] [";
+        formatted += sender->getNickname();
+        formatted += "] ";
+        formatted += msg.getContent();
+        MessageView routed(MessageType::RoomMessage, sender->getNickname(), msg.getContent(), room);
+        roomcast(room, routed, formatted, sender);
+
+        std::string& entry = scratch(1);
+        entry += '[';
+        appendTimestamp(entry);
+        entry += "] ROOM: ";
+        entry += formatted;
+        logger_.log(entry);
         break;
     }
 
     case MessageType::Connect:
     case MessageType::Disconnect: {
-        std::string sys_msg  = "\033[1;36m[System]\033[0m " + msg.getContent();
+        std::string sys_msg = "\033[1;36m[System]\033[0m ";
+        sys_msg += msg.getContent();
         broadcast(sys_msg, nullptr);
         break;
     }
@@ -395,154 +439,440 @@ void ChatServer::processMessage(ClientHandler* sender, const Message& msg) {
         }
 
         userList += "\033[1;36m========================\033[0m";
-        sender->sendMessage(userList);
+
+        std::string names;
+        for(const auto& user : users) {
+            if(!names.empty()) names += ',';
+            names += user;
+        }
+        sender->sendMessage(Message(MessageType::UsersList, "", names), userList);
         break;
     }
 
     default: {
-        std::cerr << "[" << getTimestamp() << "] [ERROR] Unknown message type: "
-                  << static_cast<int>(msg.getType()) << std::endl;
+        Log::error("Unknown message type: ", static_cast<int>(msg.getType()));
         logger_.log("[" + getTimestamp() + "] Unknown message type from " + sender->getNickname());
     }
     }
 }
 
-void ChatServer::broadcast(const std::string& message, ClientHandler* exclude) {
-    std::lock_guard<std::mutex> lock(clients_mutex_);
+void ChatServer::roomcast(const std::string& room, std::string_view message, ClientHandler* exclude) {
+    roomFanOut(room, message, nullptr, exclude);
+}
+
+void ChatServer::roomcast(const std::string& room, const MessageView& msg, std::string_view formatted,
+                          ClientHandler* exclude) {
+    roomFanOut(room, formatted, &msg, exclude);
+}
+
+// Room members may live on any shard; enqueueing is thread-safe and hands
+// the flush to the member's own shard.
+void ChatServer::roomFanOut(const std::string& room, std::string_view formatted, const MessageView* msg,
+                            ClientHandler* exclude) {
+    const Payload text = Payload::line(formatted);
+    const Payload binary = msg ? WireProtocol::encode(*msg) : WireProtocol::notice(formatted);
+    if(msg && journal_) {
+        journal_->append(binary, Journal::nowMs());
+    }
+    size_t recipients = rooms_.forEachMember(room, [&](ClientHandler& member) {
+        if(&member == exclude) return;
+        member.sendMessage(member.isBinary() ? binary : text, msg ? Traffic::Chat : Traffic::System);
+    });
+
+    Log::debug("[ROOM #", room, "] To ", recipients, " members: ", formatted);
+}
+
+void ChatServer::listRooms(ClientHandler* sender) {
+    auto rooms = rooms_.list();
+    const auto& joined = sender->getRooms();
+    std::string list = "\033[1;36m=== Rooms (" + std::to_string(rooms.size()) + ") ===\033[0m\n";
+    for(const auto& [name, members] : rooms) {
+        list += " • #" + name + " (" + std::to_string(members) + (members == 1 ? " member" : " members") + ")";
+        if(std::find(joined.begin(), joined.end(), name) != joined.end()) {
+            list += name == sender->getActiveRoom() ? " *" : " +";
+        }
+        list += "\n";
+    }
+    list += "\033[1;36m========================\033[0m";
+    sender->sendMessage(list);
+}
+
+size_t ChatServer::replayHistory(ClientHandler* client, const MessageHistory& history, size_t count) {
+    thread_local std::vector<MessageHistory::Entry> entries;
+    thread_local std::vector<Payload> batch;
+    history.recent(count, entries);
+    const size_t replayed = entries.size();
+    if(replayed == 0) return 0;
+
+    client->sendMessage("\033[1;36m[System] Last " + std::to_string(replayed) +
+                        (replayed == 1 ? " message:" : " messages:") + "\033[0m");
+    batch.clear();
+    for(const auto& entry : entries) {
+        batch.push_back(client->isBinary() ? entry.binary : entry.text);
+    }
+    client->sendMessages(batch.data(), batch.size(), Traffic::Chat);
+
+    // Drop the references so the history alone decides when buffers are recycled.
+    batch.clear();
+    entries.clear();
+    return replayed;
+}
 
-    std::cout << "[" << getTimestamp() << "] [BROADCAST] To " << clients_.size()
-              << " clients: " << message << std::endl;
+static MessageHistory::Entry historyEntry(const Journal::Record& record) {
+    std::string formatted = "[";
+    formatted += record.frame.sender;
+    formatted += "] ";
+    formatted += record.frame.content;
+    return {Payload::line(formatted), Payload::raw(record.bytes)};
+}
 
-    for(auto& client : clients_) {
-        if(client.get() != exclude) {
-            client->sendMessage(message);
+// Refills the in-memory history from the journal's newest broadcasts.
+void ChatServer::restoreHistory() {
+    std::vector<MessageHistory::Entry> entries;
+    journal_->scanBackward([&](const Journal::Record& record) {
+        if(record.frame.type == MessageType::Broadcast) {
+            entries.push_back(historyEntry(record));
         }
+        return entries.size() < kHistoryMessages;
+    });
+    for(auto entry = entries.rbegin(); entry != entries.rend(); ++entry) {
+        history_.push(entry->text, entry->binary);
     }
 }
+
+void ChatServer::replaySince(ClientHandler* client, uint32_t minutes) {
+    if(!journal_) {
+        client->sendMessage("\033[1;31m[System] Error: The message journal is disabled\033[0m");
+        return;
+    }
+
+    // Only the newest broadcasts of the window are shown, so the scan runs
+    // backward and stops once it has them.
+    minutes = std::min(minutes, kMaxSinceMinutes);
+    const uint64_t now = Journal::nowMs();
+    const uint64_t span = uint64_t{minutes} * 60000;
+    std::vector<MessageHistory::Entry> entries;
+    journal_->scanBackward(
+        [&](const Journal::Record& record) {
+            if(record.frame.type == MessageType::Broadcast) {
+                entries.push_back(historyEntry(record));
+            }
+            return entries.size() < kHistoryMessages;
+        },
+        now > span ? now - span : 0);
+    MessageHistory window(kHistoryMessages, kHistoryBytes);
+    for(auto entry = entries.rbegin(); entry != entries.rend(); ++entry) {
+        window.push(entry->text, entry->binary);
+    }
+    if(replayHistory(client, window, kHistoryMessages) == 0) {
+        client->sendMessage("\033[1;36m[System] No messages in the last " + std::to_string(minutes) +
+                            (minutes == 1 ? " minute" : " minutes") + "\033[0m");
+    }
+}
+
+void ChatServer::broadcast(std::string_view message, ClientHandler* exclude) {
+    fanOut(message, nullptr, exclude);
+}
+
+void ChatServer::broadcast(const MessageView& msg, std::string_view formatted, ClientHandler* exclude) {
+    fanOut(formatted, &msg, exclude);
+}
+
+void ChatServer::fanOut(std::string_view formatted, const MessageView* msg, ClientHandler* exclude) {
+    // Both encodings are built once and shared by every shard; each shard
+    // then fans out to its own clients on its own thread.
+    const Payload text = Payload::line(formatted);
+    const Payload binary = msg ? WireProtocol::encode(*msg) : WireProtocol::notice(formatted);
+    if(msg && msg->getType() == MessageType::Broadcast) {
+        history_.push(text, binary);
+        if(journal_) journal_->append(binary, Journal::nowMs());
+    }
+
+    size_t recipients = 0;
+    for(auto& shard : shards_) {
+        recipients += shard->size();
+        shard->post(text, binary, exclude, msg ? Traffic::Chat : Traffic::System);
+    }
+
+    Log::debug("[BROADCAST] To ", recipients, " clients: ", formatted);
+}
 void ChatServer::privateMessage(const std::string& message, const std::string& receiver) {
-    std::lock_guard<std::mutex> lock(clients_mutex_);
-    auto it = nicknames_.find(receiver);
-    if(it != nicknames_.end()) {
-        std::cout << "[" << getTimestamp() << "] Sending PM to " << receiver << ": "
-                  << message << std::endl;
-        it->second->sendMessage(message);
+    std::shared_ptr<ClientHandler> target = registry_.find(receiver);
+
+    if(target) {
+        Log::debug("Sending PM to ", receiver, ": ", message);
+        target->sendMessage(message);
     } else {
-        std::cerr << "[" << getTimestamp() << "] PM error: Receiver not found - "
-                  << receiver << std::endl;
+        Log::warn("PM error: Receiver not found - ", receiver);
     }
 }
 
-void ChatServer::scheduleClientRemoval(ClientHandler* client) {
-    std::lock_guard<std::mutex> lock(removal_mutex_);
+std::string ChatServer::formatStats() const {
+    auto uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started_at_);
+    size_t clients = 0;
+    for(const auto& shard : shards_) {
+        clients += shard->size();
+    }
+
+    std::string workers = "0";
+    if(workers_) {
+        workers = std::to_string(workers_->size()) + " (" + std::to_string(workers_->stolen()) + " stolen)";
+    }
 
-    if(std::find(clients_to_remove_.begin(), clients_to_remove_.end(), client) == clients_to_remove_.end()) {
-        clients_to_remove_.push_back(client);
+    // Occupancy of the pools that recycle per-connection memory.
+    std::string pools;
+    for(const BlockPool::Stats& pool : BlockPool::all()) {
+        pools += "pool " + std::string(pool.name) + ": " + std::to_string(pool.in_use) + " in use, " +
+                 std::to_string(pool.free) + " free, peak " + std::to_string(pool.peak) + ", " +
+                 std::to_string(pool.allocated) + " from the heap, " + std::to_string(pool.reused) + " reused\n";
     }
+    pools += "pool payload buffers: " + std::to_string(Payload::buffersInUse()) + " in use, " +
+             std::to_string(Payload::buffersFree()) + " free\n";
+
+    Metrics::Snapshot snapshot;
+    Metrics::collect(snapshot);
+    return "uptime: " + std::to_string(uptime.count()) + " s, shards: " + std::to_string(shards_.size()) +
+           ", clients: " + std::to_string(clients) + ", rooms: " + std::to_string(rooms_.list().size()) +
+           ", io: " + ioBackend() + ", workers: " + workers + ", log drops: " + std::to_string(logger_.dropped()) +
+           "\n" + Metrics::format(snapshot) + pools;
+}
+
+void ChatServer::setStatsDump(const std::string& path, std::chrono::seconds interval) {
+    stats_path_ = path;
+    stats_interval_ = interval;
+}
+
+void ChatServer::setJournal(const std::string& directory, size_t max_segments) {
+    journal_path_ = directory;
+    journal_segments_ = max_segments;
+}
+
+void ChatServer::setBackpressure(const BackpressureConfig& config) {
+    backpressure_ = config;
+}
+
+void ChatServer::setFloodControl(const FloodConfig& config) {
+    flood_ = config;
+}
+
+void ChatServer::setTimeouts(const TimeoutConfig& config) {
+    timeouts_ = config;
 }
-void ChatServer::processScheduledRemovals() {
-    std::lock_guard<std::mutex> lock(removal_mutex_);
-    for(auto* client : clients_to_remove_) {
-        clientDisconnected(client);
+
+void ChatServer::setWorkers(size_t count) {
+    worker_count_ = count;
+}
+
+size_t ChatServer::queuedBytes() const {
+    size_t total = 0;
+    for(const auto& shard : shards_) {
+        total += shard->queuedBytes();
+    }
+    return total;
+}
+
+// Rewrites the dump file every interval; the temp file + rename keeps
+// readers from ever seeing a half-written report.
+void ChatServer::dumpStats() {
+    std::unique_lock<std::mutex> lock(stats_mutex_);
+    while(running_) {
+        stats_wake_.wait_for(lock, stats_interval_);
+        if(!running_) break;
+
+        const std::string temp = stats_path_ + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::trunc);
+            out << "[" << Log::timestamp() << "]\n" << formatStats();
+        }
+        if(rename(temp.c_str(), stats_path_.c_str()) < 0) {
+            Log::error("Failed to write ", stats_path_, ": ", strerror(errno));
+        }
+    }
+}
+
+void ChatServer::flushPending() {
+    for(auto& shard : shards_) {
+        shard->drain();
     }
-    clients_to_remove_.clear();
 }
 
 std::vector<std::string> ChatServer::getOnlineUsers() const {
-    std::lock_guard<std::mutex> lock(clients_mutex_);
+    auto snapshot = registry_.snapshot();
     std::vector<std::string> users;
-    for(const auto& [nickname, client] : nicknames_) {
-        users.push_back(nickname);
+    users.reserve(snapshot->size());
+    for(const auto& entry : *snapshot) {
+        users.push_back(entry.nickname);
     }
     return users;
 }
 
-void ChatServer::processRawMessage(ClientHandler* sender, const std::string& raw_msg) {
+void ChatServer::processRawMessage(ClientHandler* sender, std::string_view raw_msg) {
     if(raw_msg.empty()) return;
 
-    if(raw_msg == "/leave") {
-        std::cout << "[" << getTimestamp() << "] Client " << sender->getSocket()
-                  << " (" << sender->getNickname() << ") requested to leave\n";
+    if(raw_msg.rfind("/nick ", 0) == 0) {
+        changeNickname(sender, raw_msg.substr(6));
+        return;
+    }
 
-        sender->sendMessage("\033[1;36m[System] You are leaving the chat. Goodbye!\033[0m");
+    if(raw_msg.rfind("/pm ", 0) == 0) {
+        size_t space_pos = raw_msg.find(' ', 4);
+        if(space_pos != std::string_view::npos) {
+            MessageView msg(MessageType::Private, sender->getNickname(),
+                            raw_msg.substr(space_pos + 1), raw_msg.substr(4, space_pos - 4));
+            processMessage(sender, msg);
+            return;
+        }
+    }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    if(raw_msg == "/users") {
+        Message msg(MessageType::UsersList, sender->getNickname(), "");
+        processMessage(sender, msg);
+        return;
+    }
 
-        sender->stopClient();
+    if(raw_msg.rfind("/join ", 0) == 0) {
+        MessageView msg(MessageType::Join, sender->getNickname(), raw_msg.substr(6));
+        processMessage(sender, msg);
         return;
     }
 
-    if(raw_msg.rfind("/nick ", 0) == 0) {
-        std::string new_nick = raw_msg.substr(6);
+    if(raw_msg == "/part" || raw_msg.rfind("/part ", 0) == 0) {
+        MessageView msg(MessageType::Part, sender->getNickname(), raw_msg.substr(std::min<size_t>(raw_msg.size(), 6)));
+        processMessage(sender, msg);
+        return;
+    }
 
-        size_t start = new_nick.find_first_not_of(" \t\r\n");
-        size_t end = new_nick.find_last_not_of(" \t\r\n");
+    if(raw_msg == "/rooms") {
+        listRooms(sender);
+        return;
+    }
 
-        if(start == std::string::npos || end == std::string::npos) {
-            sender->sendMessage("\033[1;31m[System] Error: Nickname cannot be empty\033[0m");
-            return;
+    if(raw_msg == "/history" || raw_msg.rfind("/history ", 0) == 0) {
+        size_t count = kHistoryOnJoin;
+        if(raw_msg.size() > 9) {
+            std::string_view arg = raw_msg.substr(9);
+            auto result = std::from_chars(arg.data(), arg.data() + arg.size(), count);
+            if(result.ec != std::errc() || result.ptr != arg.data() + arg.size() || count == 0) {
+                sender->sendMessage("\033[1;31m[System] Usage: /history [count]\033[0m");
+                return;
+            }
         }
-        new_nick = new_nick.substr(start, end - start + 1);
-
-        if(new_nick.length() > 20) {
-            sender->sendMessage("\033[1;31m[System] Error: Nickname too long (max 20 chars)\033[0m");
-            new_nick = new_nick.substr(0, 20);
+        if(replayHistory(sender, history_, count) == 0) {
+            sender->sendMessage("\033[1;36m[System] No messages yet\033[0m");
         }
+        return;
+    }
 
-        if(new_nick.find('|') != std::string::npos) {
-            sender->sendMessage("\033[1;31m[System] Error: Nickname cannot contain '|' character\033[0m");
+    if(raw_msg.rfind("/since ", 0) == 0) {
+        std::string_view arg = raw_msg.substr(7);
+        uint32_t minutes = 0;
+        auto result = std::from_chars(arg.data(), arg.data() + arg.size(), minutes);
+        if(result.ec != std::errc() || result.ptr != arg.data() + arg.size() || minutes == 0) {
+            sender->sendMessage("\033[1;31m[System] Usage: /since <minutes>\033[0m");
             return;
         }
+        replaySince(sender, minutes);
+        return;
+    }
 
-        Message msg(MessageType::NickChange, sender->getNickname(), new_nick);
-        processMessage(sender, msg);
+    if(raw_msg.rfind("/admin ", 0) == 0) {
+        if(!admin_password_.empty() && raw_msg.substr(7) == admin_password_) {
+            sender->setAdmin(true);
+            sender->sendMessage("\033[1;36m[System] Admin access granted\033[0m");
+            logger_.log("[" + getTimestamp() + "] ADMIN: " + sender->getNickname());
+        } else {
+            sender->sendMessage("\033[1;31m[System] Error: Admin access denied\033[0m");
+            logger_.log("[" + getTimestamp() + "] ADMIN DENIED: " + sender->getNickname());
+        }
         return;
     }
 
-    if(raw_msg.rfind("/pm ", 0) == 0) {
-        size_t space_pos = raw_msg.find(' ', 4);
-        if(space_pos != std::string::npos) {
-            std::string receiver = raw_msg.substr(4, space_pos - 4);
-            std::string content = raw_msg.substr(space_pos + 1);
-            Message msg(MessageType::Private, sender->getNickname(), content, receiver);
-            processMessage(sender, msg);
+    if(raw_msg == "/stats") {
+        if(!sender->isAdmin()) {
+            sender->sendMessage("\033[1;31m[System] Error: /stats requires admin access (/admin <password>)\033[0m");
             return;
         }
+        std::string stats = formatStats();
+        stats.pop_back();
+        sender->sendMessage("\033[1;36m=== Server stats ===\033[0m\n" + stats +
+                            "\n\033[1;36m====================\033[0m");
+        return;
     }
 
-    if(raw_msg == "/users") {
-        Message msg(MessageType::UsersList, sender->getNickname(), "");
+    const std::string& room = sender->getActiveRoom();
+    if(raw_msg.rfind("/all ", 0) == 0) {
+        raw_msg.remove_prefix(5);
+    } else if(!room.empty()) {
+        MessageView msg(MessageType::RoomMessage, sender->getNickname(), raw_msg, room);
         processMessage(sender, msg);
         return;
     }
 
-    Message msg(MessageType::Broadcast, sender->getNickname(), raw_msg);
+    MessageView msg(MessageType::Broadcast, sender->getNickname(), raw_msg);
     processMessage(sender, msg);
 }
 
-int ChatServer::getNextAvailableUserNumber() const {
-    std::lock_guard<std::mutex> lock(clients_mutex_);
-    std::set<int> usedNumbers;
+void ChatServer::processFrame(ClientHandler* sender, const WireProtocol::FrameView& frame) {
+    switch(frame.type) {
+    case MessageType::Broadcast: {
+        if(frame.content.empty()) return;
+        MessageView msg(MessageType::Broadcast, sender->getNickname(), frame.content);
+        processMessage(sender, msg);
+        break;
+    }
+    case MessageType::Private: {
+        MessageView msg(MessageType::Private, sender->getNickname(), frame.content, frame.receiver);
+        processMessage(sender, msg);
+        break;
+    }
+    case MessageType::NickChange:
+        changeNickname(sender, frame.content);
+        break;
+    case MessageType::UsersList: {
+        Message msg(MessageType::UsersList, sender->getNickname(), "");
+        processMessage(sender, msg);
+        break;
+    }
+    case MessageType::Join:
+    case MessageType::Part: {
+        MessageView msg(frame.type, sender->getNickname(), frame.content);
+        processMessage(sender, msg);
+        break;
+    }
+    case MessageType::RoomMessage: {
+        if(frame.content.empty()) return;
+        MessageView msg(MessageType::RoomMessage, sender->getNickname(), frame.content, frame.receiver);
+        processMessage(sender, msg);
+        break;
+    }
+    default:
+        sender->sendMessage("\033[1;31m[System] Error: Unsupported frame type " +
+                            std::to_string(static_cast<int>(frame.type)) + "\033[0m");
+    }
+}
 
-    for(const auto& [nickname, _] : nicknames_) {
-        if(nickname.size() >= 5 && nickname.substr(0, 4) == "User") {
-            std::string numPart = nickname.substr(4);
+void ChatServer::changeNickname(ClientHandler* sender, std::string_view requested) {
+    std::string new_nick(requested);
 
-            bool isAllDigits = !numPart.empty() &&
-                               std::all_of(numPart.begin(), numPart.end(), ::isdigit);
+    size_t start = new_nick.find_first_not_of(" \t\r\n");
+    size_t end = new_nick.find_last_not_of(" \t\r\n");
 
-            if(isAllDigits) {
-                try {
-                    int num = std::stoi(numPart);
-                    usedNumbers.insert(num);
-                } catch(...) {
-                }
-            }
-        }
+    if(start == std::string::npos || end == std::string::npos) {
+        sender->sendMessage("\033[1;31m[System] Error: Nickname cannot be empty\033[0m");
+        return;
     }
-    int candidate = 1;
-    while(usedNumbers.find(candidate) != usedNumbers.end()) {
-        candidate++;
+    new_nick = new_nick.substr(start, end - start + 1);
+
+    if(new_nick.length() > 20) {
+        sender->sendMessage("\033[1;31m[System] Error: Nickname too long (max 20 chars)\033[0m");
+        new_nick = new_nick.substr(0, 20);
     }
 
-    return candidate;
-}
\ No newline at end of file
+    if(new_nick.find('|') != std::string::npos) {
+        sender->sendMessage("\033[1;31m[System] Error: Nickname cannot contain '|' character\033[0m");
+        return;
+    }
+
+    Message msg(MessageType::NickChange, sender->getNickname(), new_nick);
+    processMessage(sender, msg);
+}
@@ -1,51 +1,140 @@
 
 #pragma once
-#include <map>
 #include <memory>
 #include <mutex>
-#include <set>
 #include <string>
+#include <string_view>
 #include <thread>
+#include "Backpressure.h"
+#include "ClientRegistry.h"
+#include "FloodControl.h"
+#include "Journal.h"
 #include "Message.h"
+#include "MessageHistory.h"
+#include "NicknameAllocator.h"
 #include "Logger.h"
+#include "RoomTable.h"
+#include "Shard.h"
+#include "Timeouts.h"
+#include "WireProtocol.h"
+#include "WorkerPool.h"
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <vector>
 
 class ClientHandler;
 
 class ChatServer {
   public:
+    // Broadcast history: ring bounds, and how much of it a new client sees.
+    static constexpr size_t kHistoryMessages = 200;
+    static constexpr size_t kHistoryBytes = 256 * 1024;
+    static constexpr size_t kHistoryOnJoin = 20;
+    // Longest window /since looks back over.
+    static constexpr uint32_t kMaxSinceMinutes = 24 * 60;
+
     void testBroadcast();
-    ChatServer(int port);
+    // shard_count 0 runs one reactor per hardware thread. io_backend falls
+    // back to epoll where io_uring is unavailable.
+    ChatServer(int port, size_t shard_count = 0, IoBackendKind io_backend = IoBackendKind::Epoll);
     std::vector<std::string> getOnlineUsers() const;
     ~ChatServer();
     bool isRunning() const {
         return running_;
     }
-    void scheduleClientRemoval(ClientHandler* client);
-    void processRawMessage(ClientHandler* sender, const std::string& raw_msg);
+    void processRawMessage(ClientHandler* sender, std::string_view raw_msg);
+    void processFrame(ClientHandler* sender, const WireProtocol::FrameView& frame);
     void start();
+    // Instead of start(): runs no shard threads, the caller drives the shards
+    // through flushPending() (chat_bench).
+    void runInline();
     void stop();
-    void addClient(std::shared_ptr<ClientHandler> client);
+    std::shared_ptr<ClientHandler> adoptClient(int socket, size_t shard = 0);
+    // client_socket is a new connection on shard, or -errno if accepting failed.
+    void acceptClient(Shard& shard, int client_socket);
+    size_t shardCount() const {
+        return shards_.size();
+    }
+    // The I/O backend the shards ended up with.
+    std::string ioBackend() const {
+        return shards_.front()->ioBackend();
+    }
+    bool addClient(std::shared_ptr<ClientHandler> client);
     void removeClient(ClientHandler* client);
-    void processMessage(ClientHandler* sender, const Message& msg);
+    void processMessage(ClientHandler* sender, const MessageView& msg);
     void clientDisconnected(ClientHandler* client);
-    void broadcast(const std::string& message, ClientHandler* exclude = nullptr);
+    void broadcast(std::string_view message, ClientHandler* exclude = nullptr);
+    void broadcast(const MessageView& msg, std::string_view formatted, ClientHandler* exclude = nullptr);
+    void roomcast(const std::string& room, std::string_view message, ClientHandler* exclude = nullptr);
+    void roomcast(const std::string& room, const MessageView& msg, std::string_view formatted,
+                  ClientHandler* exclude = nullptr);
     void privateMessage(const std::string& message,
                         const std::string& receiver);
     void stopClients();
-    void processScheduledRemovals();
+    void flushPending();
+    std::string formatStats() const;
+    // Rewrites path with formatStats() every interval (0 disables); call before start().
+    void setStatsDump(const std::string& path, std::chrono::seconds interval);
+    // Directory of the message journal (empty disables it) and how many
+    // segments it keeps; call before start().
+    void setJournal(const std::string& directory, size_t max_segments = Journal::kMaxSegments);
+    // Limits for slow consumers; call before start().
+    void setBackpressure(const BackpressureConfig& config);
+    const BackpressureConfig& backpressure() const {
+        return backpressure_;
+    }
+    // Per-client rate limits on inbound messages; call before start().
+    void setFloodControl(const FloodConfig& config);
+    const FloodConfig& floodControl() const {
+        return flood_;
+    }
+    // Idle, keepalive, linger and shutdown timeouts; call before start().
+    void setTimeouts(const TimeoutConfig& config);
+    const TimeoutConfig& timeouts() const {
+        return timeouts_;
+    }
+    // Outbound bytes queued across all clients.
+    size_t queuedBytes() const;
+    // Threads that dispatch client messages; 0 (the default) dispatches on
+    // the receiving shard's thread. Call before start().
+    void setWorkers(size_t count);
+    // The dispatch pool, or nullptr when dispatch runs on the shards.
+    WorkerPool* workers() const {
+        return workers_.get();
+    }
   private:
-    void run();
-    int getNextAvailableUserNumber() const;
-    std::mutex removal_mutex_;
-    std::vector<ClientHandler*> clients_to_remove_;
+    void dumpStats();
+    void fanOut(std::string_view formatted, const MessageView* msg, ClientHandler* exclude);
+    void roomFanOut(const std::string& room, std::string_view formatted, const MessageView* msg,
+                    ClientHandler* exclude);
+    void listRooms(ClientHandler* sender);
+    // Sends up to count of history's newest broadcasts to client; returns how many.
+    size_t replayHistory(ClientHandler* client, const MessageHistory& history, size_t count);
+    void restoreHistory();
+    void replaySince(ClientHandler* client, uint32_t minutes);
+    void changeNickname(ClientHandler* sender, std::string_view requested);
     int port_;
-    int server_socket_;
     std::atomic<bool> running_;
-    std::unique_ptr<std::thread> main_thread_;
-    std::set<std::shared_ptr<ClientHandler>> clients_;
-    std::map<std::string, std::shared_ptr<ClientHandler>> nicknames_;
-    mutable std::mutex clients_mutex_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    ClientRegistry registry_;
+    NicknameAllocator nick_allocator_;
+    RoomTable rooms_;
+    MessageHistory history_;
+    std::string journal_path_ = "journal";
+    size_t journal_segments_ = Journal::kMaxSegments;
+    std::unique_ptr<Journal> journal_;
+    BackpressureConfig backpressure_;
+    FloodConfig flood_;
+    TimeoutConfig timeouts_;
+    size_t worker_count_ = 0;
+    std::unique_ptr<WorkerPool> workers_;
     Logger<std::string> logger_;
+    std::string admin_password_;
+    std::chrono::steady_clock::time_point started_at_;
+    std::string stats_path_ = "stats.txt";
+    std::chrono::seconds stats_interval_{10};
+    std::thread stats_thread_;
+    std::mutex stats_mutex_;
+    std::condition_variable stats_wake_;
 };
@@ -1,148 +1,890 @@
 #include "ClientHandler.h"
+#include "BlockPool.h"
 #include "ChatServer.h"
+#include "Log.h"
 #include "Message.h"
+#include "Metrics.h"
+#include "Shard.h"
+#include "WorkerPool.h"
 #include <unistd.h>
 #include <cstring>
-#include <iostream>
-#include <sstream>
 #include <algorithm>
-#include <iomanip>
-#include <ctime>
-
-static std::string getTimestamp() {
-    auto now = std::chrono::system_clock::now();
-    auto in_time_t = std::chrono::system_clock::to_time_t(now);
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                  now.time_since_epoch()) % 1000;
-
-    std::tm bt;
-    localtime_r(&in_time_t, &bt);
+#include <chrono>
+#include <cerrno>
+#include <sys/uio.h>
+
+ClientHandler::ClientHandler(int socket, ChatServer* server, Shard* shard, const std::string& defaultNickname)
+    : message_bucket_(server->floodControl().messages_per_sec, server->floodControl().message_burst),
+      byte_bucket_(server->floodControl().bytes_per_sec, server->floodControl().byte_burst),
+      client_socket_(socket), server_(server), shard_(shard), active_(true), nickname_(defaultNickname) {
+}
+static BlockPool& connectionPool() {
+    static BlockPool pool("connections", sizeof(ClientHandler), 1024);
+    return pool;
+}
 
-    std::ostringstream oss;
-    oss << std::put_time(&bt, "%Y-%m-%d %H:%M:%S");
-    oss << '.' << std::setfill('0') << std::setw(3) << ms.count();
-    return oss.str();
+// The reference counts live in a separate small block rather than next to
+// the handler as with make_shared: timers hold weak references, and those
+// would otherwise keep the handler's block from being reused until they
+// fire.
+static BlockPool& referencePool() {
+    static BlockPool pool("connection refs", 64, 4096);
+    return pool;
 }
 
-ClientHandler::ClientHandler(int socket, ChatServer* server, const std::string& defaultNickname)
-    : client_socket_(socket), server_(server), active_(true), nickname_(defaultNickname) {
+std::shared_ptr<ClientHandler> ClientHandler::create(int socket, ChatServer* server, Shard* shard,
+                                                     const std::string& defaultNickname) {
+    void* memory = connectionPool().allocate(sizeof(ClientHandler));
+    ClientHandler* client;
+    try {
+        client = new(memory) ClientHandler(socket, server, shard, defaultNickname);
+    } catch(...) {
+        connectionPool().deallocate(memory, sizeof(ClientHandler));
+        throw;
+    }
+    auto destroy = [](ClientHandler* handler) {
+        handler->~ClientHandler();
+        connectionPool().deallocate(handler, sizeof(ClientHandler));
+    };
+    return std::shared_ptr<ClientHandler>(client, destroy, PoolAllocator<ClientHandler>(referencePool()));
 }
+
 ClientHandler::~ClientHandler() {
-    stopClient();
-    if(thread_ && thread_->joinable()) {
-        thread_->join();
+    discardOutbound();
+    if(client_socket_ != -1) {
+        close(client_socket_);
+        client_socket_ = -1;
     }
 }
 
 void ClientHandler::clearLine() {
-    const char clear_seq[] = "\r\033[K";
+    if(binary_) return;
+
+    static const Payload clear_seq = Payload::raw("\r\033[K");
+    enqueue(clear_seq);
+}
+
+void ClientHandler::stopClient() {
+    if(active_.exchange(false)) {
+        scheduleFlush();
+    }
+}
+
+bool ClientHandler::negotiate() {
+    char peek[WireProtocol::kPreambleSize];
+    ssize_t peeked = recv(client_socket_, peek, sizeof(peek), MSG_PEEK);
+    if(peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return false;
+    }
+
+    if(peeked <= 0 || memcmp(peek, WireProtocol::kPreamble, peeked) != 0) {
+        negotiated();
+        return true;
+    }
+    if(static_cast<size_t>(peeked) < sizeof(peek)) {
+        return false;
+    }
+
+    recv(client_socket_, peek, sizeof(peek), 0);
+    enableBinary();
+    return true;
+}
+
+// Completion backends hand over bytes that were already read, so the
+// preamble is matched as it arrives instead of being peeked at.
+bool ClientHandler::negotiate(const char*& data, size_t& size) {
+    size_t count = std::min(size, WireProtocol::kPreambleSize - preamble_matched_);
+    if(memcmp(data, WireProtocol::kPreamble + preamble_matched_, count) != 0) {
+        negotiated();
+        // What matched so far starts a text line after all.
+        receive(WireProtocol::kPreamble, preamble_matched_);
+        return true;
+    }
+
+    preamble_matched_ += count;
+    data += count;
+    size -= count;
+    if(preamble_matched_ < WireProtocol::kPreambleSize) {
+        return false;
+    }
+    enableBinary();
+    return true;
+}
+
+void ClientHandler::enableBinary() {
+    decoder_ = std::make_unique<FrameDecoder>();
+    binary_ = true;
+    enqueue(WireProtocol::preamble());
+    negotiated();
+
+    Log::debug("Client ", client_socket_, " (", nickname_, ") switched to binary protocol");
+}
+
+void ClientHandler::negotiated() {
+    negotiated_ = true;
+    session_ = binary_ ? binarySession() : textSession();
+}
+
+Session ClientHandler::textSession() {
+    while(true) {
+        std::string_view line = co_await readLine();
+        const bool leaving = line == "/leave";
+        dispatch(line);
+        if(leaving) co_return;
 
-    if(send(client_socket_, clear_seq, sizeof(clear_seq) - 1, 0) < 0) {
-        std::cerr << "[" << getTimestamp() << "] Failed to clear line for client "
-                  << client_socket_ << std::endl;
+        // Stop taking commands from a client that is not reading the replies.
+        co_await drained();
     }
 }
 
-void ClientHandler::start() {
-    thread_ = std::make_unique<std::thread>(&ClientHandler::run, this);
+Session ClientHandler::binarySession() {
+    while(true) {
+        const WireProtocol::FrameView& frame = co_await readFrame();
+        const bool leaving = frame.type == MessageType::Disconnect;
+        dispatch(frame);
+        if(leaving) co_return;
+
+        co_await drained();
+    }
+}
+
+bool ClientHandler::LineAwaiter::await_ready() {
+    return client.nextHeld();
+}
+
+void ClientHandler::LineAwaiter::await_suspend(std::coroutine_handle<> session) {
+    client.reader_ = session;
+}
+
+std::string_view ClientHandler::LineAwaiter::await_resume() {
+    return client.line_;
+}
+
+bool ClientHandler::FrameAwaiter::await_ready() {
+    return client.nextHeld();
+}
+
+void ClientHandler::FrameAwaiter::await_suspend(std::coroutine_handle<> session) {
+    client.reader_ = session;
+}
+
+const WireProtocol::FrameView& ClientHandler::FrameAwaiter::await_resume() {
+    return client.frame_;
+}
+
+// Only the shard's thread clears congestion, so nothing can change the
+// answer between here and await_suspend().
+bool ClientHandler::DrainAwaiter::await_ready() {
+    std::lock_guard<std::mutex> lock(client.outbound_mutex_);
+    return client.congested_since_ns_ == 0 || !client.active_;
+}
+
+void ClientHandler::DrainAwaiter::await_suspend(std::coroutine_handle<> session) {
+    client.writer_ = session;
+}
+
+// Lines and frames go straight to a session waiting for them; the views
+// stay valid until it suspends again, so nothing is copied.
+void ClientHandler::input(std::string_view line) {
+    if(!active_) return;
+    if(reader_ && held_head_ == held_.size()) {
+        switch(admit(line.size(), line == "/leave")) {
+        case Admission::Admit:
+            line_ = line;
+            std::exchange(reader_, nullptr).resume();
+            return;
+        case Admission::Drop:
+            return;
+        case Admission::Delay:
+            break;
+        }
+    }
+    hold(std::string(line));
+}
+
+void ClientHandler::input(const WireProtocol::FrameView& frame) {
+    if(!active_) return;
+    if(reader_ && held_head_ == held_.size()) {
+        switch(admit(frame.content.size(), frame.type == MessageType::Disconnect)) {
+        case Admission::Admit:
+            frame_ = frame;
+            std::exchange(reader_, nullptr).resume();
+            return;
+        case Admission::Drop:
+            return;
+        case Admission::Delay:
+            break;
+        }
+    }
+    Payload encoded = WireProtocol::encode(frame.type, frame.sender, frame.content, frame.receiver);
+    hold(std::string(encoded.data(), encoded.size()));
+}
+
+void ClientHandler::hold(std::string bytes) {
+    held_bytes_ += bytes.size();
+    held_.push_back(std::move(bytes));
+    if(held_bytes_ > server_->backpressure().high_water) {
+        Log::warn("Disconnecting client ", client_socket_, ": ", held_bytes_, " bytes of input held back");
+        Metrics::add(Metrics::Counter::SlowDisconnects);
+        disconnect();
+    }
 }
-void ClientHandler::run() {
-    std::cout << "[" << getTimestamp() << "] Client handler started for socket: "
-              << client_socket_ << std::endl;
 
-    char buffer[1024];
+// Moves the oldest held line or frame that flood control admits into
+// line_ / frame_, discarding dropped ones on the way.
+bool ClientHandler::nextHeld() {
+    while(held_head_ < held_.size() && active_) {
+        const std::string& next = held_[held_head_];
+        size_t bytes = next.size();
+        bool leaving = next == "/leave";
+        // Held frames were re-encoded from ones that already parsed.
+        size_t consumed = 0;
+        if(binary_) {
+            WireProtocol::parse(next.data(), next.size(), frame_, consumed);
+            bytes = frame_.content.size();
+            leaving = frame_.type == MessageType::Disconnect;
+        }
+
+        Admission admission = admit(bytes, leaving);
+        if(admission == Admission::Delay) return false;
+
+        current_ = std::move(held_[held_head_++]);
+        // Taken entries are dropped once they are at least half the vector,
+        // so a client held back for long does not keep them all.
+        if(held_head_ * 2 >= held_.size()) {
+            held_.erase(held_.begin(), held_.begin() + held_head_);
+            held_head_ = 0;
+        }
+        held_bytes_ -= current_.size();
+        if(admission == Admission::Drop) continue;
+
+        if(binary_) {
+            WireProtocol::parse(current_.data(), current_.size(), frame_, consumed);
+        } else {
+            line_ = current_;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Charges one message of the given size to the client's buckets. Leaving
+// is never held back.
+ClientHandler::Admission ClientHandler::admit(size_t bytes, bool leaving) {
+    if(leaving) return Admission::Admit;
+
+    const uint64_t now = Metrics::nowNs();
+    const uint64_t wait = std::max(message_bucket_.wait(1, now), byte_bucket_.wait(bytes, now));
+    if(wait == 0) {
+        message_bucket_.take(1);
+        byte_bucket_.take(bytes);
+        return Admission::Admit;
+    }
+
+    const FloodPolicy policy = server_->floodControl().policy;
+    if(policy == FloodPolicy::Disconnect) {
+        Metrics::add(Metrics::Counter::FloodDisconnects);
+        Log::warn("Disconnecting client ", client_socket_, " (", nicknameCopy(), "): sending too fast");
+        sendMessage("\033[1;31m[System] You are sending messages too fast. Disconnecting.\033[0m");
+        stopClient();
+        return Admission::Drop;
+    }
+
+    // Tell the client what is going on, but not for every message.
+    if(flood_warned_ns_ == 0 || now - flood_warned_ns_ >= 5'000'000'000ull) {
+        flood_warned_ns_ = now;
+        sendMessage(policy == FloodPolicy::Drop
+                        ? "\033[1;31m[System] You are sending messages too fast; some were dropped.\033[0m"
+                        : "\033[1;31m[System] You are sending messages too fast; slowing you down.\033[0m");
+    }
+    if(policy == FloodPolicy::Drop) {
+        Metrics::add(Metrics::Counter::FloodDrops);
+        return Admission::Drop;
+    }
+
+    if(!flood_timer_armed_) {
+        flood_timer_armed_ = true;
+        Metrics::add(Metrics::Counter::FloodThrottles);
+        shard_->schedule(now + wait, [self = shared_from_this()] {
+            self->floodTimer();
+        });
+    }
+    return Admission::Delay;
+}
+
+// The buckets have refilled enough for the oldest held message. A session
+// that is busy in drained() picks it up itself when it asks for input.
+void ClientHandler::floodTimer() {
+    flood_timer_armed_ = false;
+    if(!reader_ || !active_ || !nextHeld()) return;
+    std::exchange(reader_, nullptr).resume();
+}
+
+static uint64_t toNs(std::chrono::nanoseconds duration) {
+    return static_cast<uint64_t>(duration.count());
+}
+
+// Idle timeout and keepalive share one timer, which is not moved on every
+// read: when it fires it looks at the last input and sets itself again for
+// whichever deadline that leaves next. It holds only a weak reference, so
+// a client that is gone is not kept open until it fires.
+void ClientHandler::watchIdle() {
+    const TimeoutConfig& timeouts = server_->timeouts();
+    const uint64_t idle = toNs(timeouts.idle);
+    const uint64_t keepalive = toNs(timeouts.keepalive);
+    if(idle == 0 && keepalive == 0) return;
+
+    uint64_t due = UINT64_MAX;
+    if(idle != 0) {
+        due = last_input_ns_ + idle;
+    }
+    if(keepalive != 0) {
+        due = std::min(due, std::max(last_input_ns_, last_ping_ns_) + keepalive);
+    }
+    shard_->schedule(due, [client = weak_from_this()] {
+        if(auto self = client.lock()) {
+            self->idleTimer();
+        }
+    });
+}
+
+void ClientHandler::idleTimer() {
+    if(!active_) return;
+
+    const TimeoutConfig& timeouts = server_->timeouts();
+    const uint64_t idle = toNs(timeouts.idle);
+    const uint64_t keepalive = toNs(timeouts.keepalive);
+    const uint64_t now = Metrics::nowNs();
+
+    if(idle != 0 && now - last_input_ns_ >= idle) {
+        Log::info("Client ", client_socket_, " (", nicknameCopy(), ") idle for ", timeouts.idle.count(),
+                  " s, disconnecting");
+        Metrics::add(Metrics::Counter::IdleDisconnects);
+        sendMessage("\033[1;36m[System] Disconnected for inactivity.\033[0m");
+        stopClient();
+        return;
+    }
+
+    if(keepalive != 0 && now - std::max(last_input_ns_, last_ping_ns_) >= keepalive) {
+        // Nothing a client shows: an empty notice frame, or an attribute
+        // reset on a terminal. A peer that is gone makes the write fail.
+        static const Payload text_ping = Payload::raw("\033[0m");
+        static const Payload binary_ping = WireProtocol::notice("");
+        last_ping_ns_ = now;
+        Metrics::add(Metrics::Counter::KeepalivePings);
+        enqueue(binary_ ? binary_ping : text_ping);
+    }
+    watchIdle();
+}
+
+// A client that is leaving gets the linger timeout to read what is still
+// queued for it before its socket is closed.
+void ClientHandler::linger() {
+    if(lingering_ || removal_scheduled_) return;
+    lingering_ = true;
+
+    const uint64_t timeout = toNs(server_->timeouts().linger);
+    if(timeout == 0) {
+        disconnect();
+        return;
+    }
+    shard_->schedule(Metrics::nowNs() + timeout, [self = shared_from_this()] {
+        if(self->removal_scheduled_) return;
+        Metrics::add(Metrics::Counter::LingerTimeouts);
+        self->disconnect();
+    });
+}
+
+void ClientHandler::dispatch(std::string_view line) {
+    WorkerPool* workers = server_->workers();
+    if(!workers) {
+        handleLine(line);
+        return;
+    }
+    post(*workers, Payload::raw(line));
+}
+
+void ClientHandler::dispatch(const WireProtocol::FrameView& frame) {
+    WorkerPool* workers = server_->workers();
+    if(!workers) {
+        handleFrame(frame);
+        return;
+    }
+    post(*workers, WireProtocol::encode(frame.type, frame.sender, frame.content, frame.receiver));
+}
+
+// A client's messages are handled in arrival order by one worker at a time:
+// only the first message queued while none is running schedules a task.
+void ClientHandler::post(WorkerPool& workers, Payload message) {
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        inbox_.push_back(std::move(message));
+        if(dispatch_scheduled_) return;
+        dispatch_scheduled_ = true;
+    }
+    workers.submit([self = shared_from_this()] {
+        self->dispatchInbox();
+    });
+}
+
+// Everything the client sent before it went away is still handled, unless
+// the server is shutting down; a disconnect waits for it (see disconnect()).
+void ClientHandler::dispatchInbox() {
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        dispatching_.swap(inbox_);
+    }
+    for(const Payload& message : dispatching_) {
+        if(!server_->isRunning()) break;
+        if(binary_) {
+            WireProtocol::FrameView frame;
+            size_t consumed = 0;
+            WireProtocol::parse(message.data(), message.size(), frame, consumed);
+            handleFrame(frame);
+        } else {
+            handleLine(std::string_view(message.data(), message.size()));
+        }
+    }
+    dispatching_.clear();
+
+    WorkerPool* workers = server_->workers();
+    bool remove = false;
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        if(inbox_.empty() || !workers) {
+            dispatch_scheduled_ = false;
+            remove = std::exchange(removal_deferred_, false);
+            workers = nullptr;
+        }
+    }
+    if(remove) {
+        shard_->scheduleRemoval(this);
+    }
+    if(!workers) return;
+
+    // More arrived meanwhile. Going back to the pool instead of looping
+    // lets the clients queued behind this one have their turn.
+    workers->submit([self = shared_from_this()] {
+        self->dispatchInbox();
+    });
+}
+
+void ClientHandler::handleLine(std::string_view raw_msg) {
+    uint64_t start = Metrics::nowNs();
+    clearLine();
+
+    if(raw_msg == "/leave") {
+        leave();
+        return;
+    }
+
     try {
-        while(active_) {
-            sendPrompt();
+        server_->processRawMessage(this, raw_msg);
+    } catch(const std::exception& e) {
+        Log::error("Exception in client handler for socket ", client_socket_, ": ", e.what());
+    }
+    sendPrompt();
+    Metrics::record(Metrics::Latency::Dispatch, Metrics::nowNs() - start);
+}
 
-            memset(buffer, 0, sizeof(buffer));
-            fd_set read_fds;
-            FD_ZERO(&read_fds);
-            FD_SET(client_socket_, &read_fds);
+void ClientHandler::handleFrame(const WireProtocol::FrameView& frame) {
+    if(frame.type == MessageType::Disconnect) {
+        leave();
+        return;
+    }
 
-            timeval timeout;
-            timeout.tv_sec = 1;
-            timeout.tv_usec = 0;
+    uint64_t start = Metrics::nowNs();
+    try {
+        server_->processFrame(this, frame);
+    } catch(const std::exception& e) {
+        Log::error("Exception in client handler for socket ", client_socket_, ": ", e.what());
+    }
+    Metrics::record(Metrics::Latency::Dispatch, Metrics::nowNs() - start);
+}
 
-            int ready = select(client_socket_ + 1, &read_fds, nullptr, nullptr, &timeout);
+// Handles /leave and Disconnect frames. The goodbye is queued and the client
+// stopped in one step, so a flush on the shard cannot slip a prompt in after
+// it while a worker runs this.
+void ClientHandler::leave() {
+    static const std::string goodbye = "\033[1;36m[System] You are leaving the chat. Goodbye!\033[0m";
+    const Payload payload = binary_ ? WireProtocol::notice(goodbye) : Payload::line(goodbye);
+    {
+        std::lock_guard<std::mutex> lock(outbound_mutex_);
+        if(!active_.exchange(false)) return;
+        outbound_.push(payload);
+        prompt_pending_ = false;
+    }
+    Log::info("Client ", client_socket_, " (", nickname_, ") requested to leave");
+    shard_->addQueued(payload.size());
+    Metrics::add(Metrics::Counter::BytesQueued, payload.size());
+    scheduleFlush();
+}
 
-            if(!active_) break;
+// Called after a flush: a session waiting in drained() continues once the
+// queue is back under the low-water mark.
+void ClientHandler::resumeWriter() {
+    if(!writer_ || !active_) return;
+    {
+        std::lock_guard<std::mutex> lock(outbound_mutex_);
+        if(congested_since_ns_ != 0) return;
+    }
+    try {
+        std::exchange(writer_, nullptr).resume();
+    } catch(const std::exception& e) {
+        Log::error("Exception in client handler for socket ", client_socket_, ": ", e.what());
+    }
+}
+
+void ClientHandler::onReadable(bool hung_up) {
+    try {
+        last_input_ns_ = Metrics::nowNs();
+        if(!negotiated_ && !negotiate()) return;
 
-            if(ready < 0) {
+        while(active_) {
+            auto [buffer, capacity] = binary_ ? decoder_->writable() : framer_.writable();
+            ssize_t bytes_received = recv(client_socket_, buffer, capacity, 0);
+
+            if(bytes_received < 0) {
                 if(errno == EINTR) continue;
-                std::cerr << "[" << getTimestamp() << "] select error for client "
-                          << client_socket_ << ": " << strerror(errno) << std::endl;
-                break;
+                if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+                readFailed(errno);
+                return;
             }
-
-            if(ready == 0) continue;
-
-            ssize_t bytes_received = recv(client_socket_, buffer, sizeof(buffer) - 1, 0);
-
-            if(bytes_received <= 0) {
-                if(bytes_received == 0) {
-                    std::cout << "[" << getTimestamp() << "] Client " << client_socket_
-                              << " (" << nickname_ << ") disconnected" << std::endl;
-                } else {
-                    if(errno == ECONNRESET) {
-                        std::cout << "[" << getTimestamp() << "] Client " << client_socket_
-                                  << " (" << nickname_ << ") force disconnected (Ctrl+C)\n";
-                    } else {
-                        std::cerr << "[" << getTimestamp() << "] recv error from client " << client_socket_
-                                  << " (" << nickname_ << "): " << strerror(errno) << std::endl;
-                    }
-                }
-                active_ = false;
-                break;
+            if(bytes_received == 0) {
+                readFailed(0);
+                return;
             }
 
-            buffer[bytes_received] = '\0';
-            std::string raw_msg(buffer);
+            Metrics::add(Metrics::Counter::BytesIn, static_cast<uint64_t>(bytes_received));
+            consume(static_cast<size_t>(bytes_received));
 
-            raw_msg.erase(std::remove(raw_msg.begin(), raw_msg.end(), '\n'), raw_msg.end());
-            raw_msg.erase(std::remove(raw_msg.begin(), raw_msg.end(), '\r'), raw_msg.end());
+            // A short read emptied the socket. Data arriving later raises a
+            // new edge, so the recv() that would only return EAGAIN is
+            // skipped, unless the peer has hung up: its EOF is not signalled
+            // again.
+            if(!hung_up && static_cast<size_t>(bytes_received) < capacity) break;
+        }
+    } catch(const std::exception& e) {
+        Log::error("Exception in client handler for socket ", client_socket_, ": ", e.what());
+    }
 
-            if(!raw_msg.empty()) {
-                const char clear_line[] = "\r\033[K";
-                send(client_socket_, clear_line, sizeof(clear_line) - 1, MSG_NOSIGNAL);
+    if(!active_) {
+        flush();
+    }
+}
 
-                if(raw_msg == "/leave") {
-                    sendMessage("\033[1;36m[System] You are leaving the chat. Goodbye!\033[0m");
-                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
-                    stopClient();
-                    break;
-                }
+void ClientHandler::onReceived(const char* data, ssize_t size) {
+    if(size <= 0) {
+        readFailed(static_cast<int>(-size));
+        return;
+    }
 
-                server_->processRawMessage(this, raw_msg);
-                prompt_pending_ = true;
-            }
+    last_input_ns_ = Metrics::nowNs();
+    try {
+        Metrics::add(Metrics::Counter::BytesIn, static_cast<uint64_t>(size));
+        size_t remaining = static_cast<size_t>(size);
+        if(negotiated_ || negotiate(data, remaining)) {
+            receive(data, remaining);
         }
     } catch(const std::exception& e) {
-        std::cerr << "[" << getTimestamp() << "] Exception in client handler for socket "
-                  << client_socket_ << ": " << e.what() << std::endl;
+        Log::error("Exception in client handler for socket ", client_socket_, ": ", e.what());
     }
 
-    stopClient();
-    server_->scheduleClientRemoval(this);
+    if(!active_) {
+        flush();
+    }
+}
 
-    std::cout << "[" << getTimestamp() << "] Client handler exiting for socket: "
-              << client_socket_ << std::endl;
+// Copies bytes the backend already read into the framer (or frame decoder)
+// and handles whatever they complete.
+void ClientHandler::receive(const char* data, size_t size) {
+    while(size > 0 && active_) {
+        auto [buffer, capacity] = binary_ ? decoder_->writable() : framer_.writable();
+        if(capacity == 0) {
+            disconnect();
+            return;
+        }
+
+        size_t chunk = std::min(size, capacity);
+        memcpy(buffer, data, chunk);
+        consume(chunk);
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+void ClientHandler::consume(size_t bytes) {
+    if(binary_) {
+        decoder_->commit(bytes);
+        decoder_->extract(
+            [this](const WireProtocol::FrameView& frame) {
+                input(frame);
+            },
+            [this]() {
+                sendMessage("\033[1;31m[System] Error: Malformed frame\033[0m");
+                stopClient();
+            });
+    } else {
+        framer_.commit(bytes);
+        framer_.extract(
+            [this](std::string_view line) {
+                input(line);
+            },
+            [this]() {
+                sendMessage("\033[1;31m[System] Error: Message too long (max " +
+                            std::to_string(framer_.maxLine()) + " chars)\033[0m");
+            });
+    }
+}
+
+// error is the errno of a failed read, 0 when the peer closed the connection.
+void ClientHandler::readFailed(int error) {
+    if(error == 0) {
+        Log::info("Client ", client_socket_, " (", nicknameCopy(), ") disconnected");
+    } else if(error == ECONNRESET) {
+        Log::info("Client ", client_socket_, " (", nicknameCopy(), ") force disconnected (Ctrl+C)");
+    } else {
+        Log::error("recv error from client ", client_socket_, " (", nicknameCopy(), "): ", strerror(error));
+    }
+    disconnect();
+}
+
+void ClientHandler::onWritable() {
+    flush();
+}
+
+// Nothing new reaches the inbox once active_ is cleared, but a worker may
+// still be handling what is in it. The client is then removed when that
+// worker is done, so the removal never races its nickname or room changes.
+void ClientHandler::disconnect() {
+    if(removal_scheduled_) return;
+    removal_scheduled_ = true;
+    active_ = false;
+    Log::debug("Client connection closed for socket: ", client_socket_);
+
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        if(dispatch_scheduled_) {
+            removal_deferred_ = true;
+            return;
+        }
+    }
+    shard_->scheduleRemoval(this);
 }
 
 void ClientHandler::sendMessage(const std::string& msg) {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
+    if(binary_) {
+        sendMessage(WireProtocol::notice(msg));
+    } else {
+        sendMessage(Payload::line(msg));
+    }
+}
+
+void ClientHandler::sendMessage(const MessageView& msg, std::string_view formatted) {
+    sendMessage(binary_ ? WireProtocol::encode(msg) : Payload::line(formatted), Traffic::Chat);
+}
+
+void ClientHandler::sendMessage(const Payload& payload, Traffic traffic) {
+    sendMessages(&payload, 1, traffic);
+}
+
+void ClientHandler::sendMessages(const Payload* payloads, size_t count, Traffic traffic) {
+    {
+        std::lock_guard<std::mutex> lock(outbound_mutex_);
+        prompt_pending_ = true;
+    }
+    enqueue(payloads, count, traffic);
+}
+
+void ClientHandler::enqueue(const Payload& payload) {
+    enqueue(&payload, 1, Traffic::System);
+}
+
+// Queues the whole batch under one lock and schedules a single flush, which
+// writes it out with as few sendmsg() calls as the iovec limit allows. Once
+// the client stops keeping up, the server's backpressure policy decides what
+// is dropped instead. Runs on any sender's thread, so it logs the socket
+// rather than the nickname its owner may be changing.
+void ClientHandler::enqueue(const Payload* payloads, size_t count, Traffic traffic) {
+    const BackpressureConfig& limits = server_->backpressure();
+    size_t queued_bytes = 0;
+    size_t evicted_bytes = 0;
+    size_t dropped = 0;
+    size_t evicted = 0;
+    size_t shed = 0;
+    bool became_congested = false;
+    bool timed_out = false;
+    {
+        std::lock_guard<std::mutex> lock(outbound_mutex_);
+        for(size_t i = 0; i < count && !timed_out; ++i) {
+            const size_t size = payloads[i].size();
+            const size_t after = outbound_.bytes() + size;
+            // The budget check sums every shard, so it is only paid by
+            // clients that are already falling behind.
+            if(after > limits.high_water ||
+               (after > limits.low_water && server_->queuedBytes() > limits.memory_budget)) {
+                if(congested_since_ns_ == 0) {
+                    congested_since_ns_ = Metrics::nowNs();
+                    became_congested = true;
+                }
+
+                switch(limits.policy) {
+                case BackpressurePolicy::DropOldest: {
+                    size_t before = outbound_.bytes();
+                    evicted += outbound_.dropOldest(limits.low_water > size ? limits.low_water - size : 0);
+                    evicted_bytes += before - outbound_.bytes();
+                    break;
+                }
+                case BackpressurePolicy::DropNonSystem:
+                    if(traffic == Traffic::Chat) {
+                        ++shed;
+                        continue;
+                    }
+                    if(after > 2 * limits.high_water) {
+                        ++dropped;
+                        continue;
+                    }
+                    break;
+                case BackpressurePolicy::Disconnect:
+                    timed_out = Metrics::nowNs() - congested_since_ns_ >=
+                                static_cast<uint64_t>(std::chrono::nanoseconds(limits.disconnect_after).count());
+                    ++dropped;
+                    continue;
+                }
+            }
+
+            outbound_.push(payloads[i]);
+            queued_bytes += size;
+        }
+        dropped_messages_ += dropped + evicted + shed;
+        if(timed_out) {
+            discardOutboundLocked();
+            active_ = false;
+        }
+    }
+
+    shard_->addQueued(queued_bytes);
+    if(evicted_bytes > 0) {
+        shard_->removeQueued(evicted_bytes);
+        Metrics::add(Metrics::Counter::BytesDiscarded, evicted_bytes);
+    }
+    Metrics::add(Metrics::Counter::BytesQueued, queued_bytes);
+    if(dropped > 0) Metrics::add(Metrics::Counter::DroppedSends, dropped);
+    if(evicted > 0) Metrics::add(Metrics::Counter::EvictedSends, evicted);
+    if(shed > 0) Metrics::add(Metrics::Counter::ShedSends, shed);
+
+    if(became_congested) {
+        Metrics::add(Metrics::Counter::Congestions);
+        Log::warn("Client ", client_socket_, " is not keeping up, applying backpressure");
+    }
+    if(timed_out) {
+        Metrics::add(Metrics::Counter::SlowDisconnects);
+        Log::warn("Disconnecting client ", client_socket_, ": congested for over ",
+                  limits.disconnect_after.count(), " ms");
+    }
+    if(queued_bytes > 0 || timed_out) {
+        scheduleFlush();
+    }
+}
+
+void ClientHandler::discardOutbound() {
+    std::lock_guard<std::mutex> lock(outbound_mutex_);
+    discardOutboundLocked();
+}
+
+void ClientHandler::discardOutboundLocked() {
+    size_t bytes = outbound_.bytes();
+    if(bytes == 0) return;
+    Metrics::add(Metrics::Counter::BytesDiscarded, bytes);
+    shard_->removeQueued(bytes);
+    outbound_.clear();
+}
+
+void ClientHandler::scheduleFlush() {
+    {
+        std::lock_guard<std::mutex> lock(outbound_mutex_);
+        if(flush_scheduled_) return;
+        flush_scheduled_ = true;
+        flush_requested_ns_ = Metrics::nowNs();
+    }
+    shard_->scheduleFlush(shared_from_this());
+}
+
+void ClientHandler::flush() {
+    uint64_t requested;
+    {
+        std::lock_guard<std::mutex> lock(outbound_mutex_);
+        requested = flush_requested_ns_;
+        flush_requested_ns_ = 0;
+        flush_scheduled_ = false;
+        if(prompt_pending_ && active_ && !binary_) {
+            static const Payload prompt = Payload::raw("\033[1;32m> \033[0m");
+            outbound_.push(prompt);
+            shard_->addQueued(prompt.size());
+            Metrics::add(Metrics::Counter::BytesQueued, prompt.size());
+            prompt_pending_ = false;
+        }
+    }
 
-    std::string formatted = "\r" + msg + "\n";
+    const bool written = writePending();
+    if(!written) {
+        shard_->waitWritable(client_socket_);
+    }
+    // Time from the first send that needed this flush until it was written
+    // (or left waiting for the socket to drain).
+    if(requested != 0) {
+        Metrics::record(Metrics::Latency::Send, Metrics::nowNs() - requested);
+    }
+    resumeWriter();
 
-    ssize_t bytes_sent = send(client_socket_, formatted.c_str(), formatted.size(), MSG_NOSIGNAL);
-    if(bytes_sent < 0) {
-        if(errno != EPIPE && errno != ECONNRESET) {
-            std::cerr << "[" << getTimestamp() << "] [ERROR] send() failed: "
-                      << strerror(errno) << "\n";
+    if(!active_) {
+        if(written) {
+            disconnect();
+        } else {
+            linger();
         }
     }
+}
 
-    prompt_pending_ = true;
+bool ClientHandler::writePending() {
+    constexpr int kMaxIov = 64;
+
+    while(true) {
+        iovec iov[kMaxIov];
+        int count = 0;
+        {
+            std::lock_guard<std::mutex> lock(outbound_mutex_);
+            if(outbound_.empty()) return true;
+            count = outbound_.fillIov(iov, kMaxIov);
+        }
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+
+        ssize_t bytes_sent = sendmsg(client_socket_, &msg, MSG_NOSIGNAL);
+        if(bytes_sent < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return false;
+
+            if(errno != EPIPE && errno != ECONNRESET) {
+                Log::error("send() failed: ", strerror(errno));
+            }
+            std::lock_guard<std::mutex> lock(outbound_mutex_);
+            discardOutboundLocked();
+            active_ = false;
+            return true;
+        }
+
+        Metrics::add(Metrics::Counter::BytesOut, static_cast<uint64_t>(bytes_sent));
+        shard_->removeQueued(static_cast<size_t>(bytes_sent));
+        std::lock_guard<std::mutex> lock(outbound_mutex_);
+        outbound_.consume(static_cast<size_t>(bytes_sent));
+        if(congested_since_ns_ != 0 && outbound_.bytes() <= server_->backpressure().low_water) {
+            congested_since_ns_ = 0;
+        }
+    }
 }
 
 void ClientHandler::handleMessage(const std::string& msg) {
@@ -154,23 +896,45 @@ void ClientHandler::handleMessage(const std::string& msg) {
         sendMessage(error_msg);
     }
 }
-std::string ClientHandler::getNickname() const {
+const std::string& ClientHandler::getNickname() const {
     return nickname_;
 }
 
 void ClientHandler::setNickname(const std::string& nickname) {
+    std::lock_guard<std::mutex> lock(nickname_mutex_);
     nickname_ = nickname;
 }
 
-void ClientHandler::sendPrompt() {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
+// With dispatch workers, setNickname() runs on a worker while the shard may
+// be logging about the client.
+std::string ClientHandler::nicknameCopy() const {
+    std::lock_guard<std::mutex> lock(nickname_mutex_);
+    return nickname_;
+}
+
+const std::string& ClientHandler::getActiveRoom() const {
+    static const std::string none;
+    return rooms_.empty() ? none : rooms_.back();
+}
 
-    if(!prompt_pending_) return;
+// rooms_ is kept in join order with the active room last, so entering a
+// room that was already joined just moves it to the back.
+void ClientHandler::enterRoom(const std::string& room) {
+    leaveRoom(room);
+    rooms_.push_back(room);
+}
 
-    const char prompt[] = "\033[1;32m> \033[0m";
-    ssize_t bytes_sent = send(client_socket_, prompt, sizeof(prompt) - 1, MSG_NOSIGNAL);
+void ClientHandler::leaveRoom(const std::string& room) {
+    auto it = std::find(rooms_.begin(), rooms_.end(), room);
+    if(it != rooms_.end()) {
+        rooms_.erase(it);
+    }
+}
 
-    if(bytes_sent > 0) {
-        prompt_pending_ = false;
+void ClientHandler::sendPrompt() {
+    {
+        std::lock_guard<std::mutex> lock(outbound_mutex_);
+        prompt_pending_ = true;
     }
-}
\ No newline at end of file
+    scheduleFlush();
+}
@@ -1,55 +1,210 @@
 #pragma once
+#include <atomic>
+#include <cstddef>
+#include <coroutine>
+#include <cstdint>
 #include <memory>
 #include <string>
-#include <thread>
+#include <string_view>
+#include <vector>
 #include <sys/socket.h>
 #include <unistd.h>
+#include "Backpressure.h"
+#include "FloodControl.h"
 #include "Message.h"
-#include <iostream>
+#include "OutboundQueue.h"
+#include "LineFramer.h"
+#include "Session.h"
+#include "FrameDecoder.h"
+#include "IoBackend.h"
+#include "WireProtocol.h"
 #include <mutex>
 
 class ChatServer;
+class Shard;
+class WorkerPool;
 
-class ClientHandler {
+class ClientHandler : public IoConnection, public std::enable_shared_from_this<ClientHandler> {
   public:
-    void debugInfo() const {
-        std::cout << "ClientHandler [Socket: " << client_socket_
-                  << ", Nick: " << nickname_
-                  << ", Active: " << active_
-                  << ", Thread: " << (thread_ ? "yes" : "no")
-                  << "]\n";
-    }
     void clearLine();
-    ClientHandler(int socket, ChatServer* server, const std::string& defaultNickname);
-    ~ClientHandler();
+    ClientHandler(int socket, ChatServer* server, Shard* shard, const std::string& defaultNickname);
+    // Allocates the handler and its reference counts from pools that
+    // recycle them between connections.
+    static std::shared_ptr<ClientHandler> create(int socket, ChatServer* server, Shard* shard,
+                                                 const std::string& defaultNickname);
+    ~ClientHandler() override;
     void sendPrompt();
-    void start();
+    void onReadable(bool hung_up = false) override;
+    void onReceived(const char* data, ssize_t size) override;
+    void onWritable() override;
+    void flush();
     void sendMessage(const std::string& msg);
-    std::string getNickname() const;
+    void sendMessage(const MessageView& msg, std::string_view formatted);
+    void sendMessage(const Payload& payload, Traffic traffic = Traffic::System);
+    void sendMessages(const Payload* payloads, size_t count, Traffic traffic);
+    const std::string& getNickname() const;
     void setNickname(const std::string& nickname);
+    const std::vector<std::string>& getRooms() const {
+        return rooms_;
+    }
+    // Room that plain chat lines go to; empty for the global chat.
+    const std::string& getActiveRoom() const;
+    void enterRoom(const std::string& room);
+    void leaveRoom(const std::string& room);
     int getSocket() const {
         return client_socket_;
     }
-
-    void stopClient() {
-        if(active_) {
-            active_ = false;
-            if(client_socket_ != -1) {
-                shutdown(client_socket_, SHUT_RDWR);
-                close(client_socket_);
-                client_socket_ = -1;
-            }
-        }
+    bool isActive() const {
+        return active_;
+    }
+    bool isBinary() const {
+        return binary_;
+    }
+    size_t getDroppedMessages() const {
+        return dropped_messages_;
+    }
+    bool isAdmin() const {
+        return admin_;
+    }
+    void setAdmin(bool admin) {
+        admin_ = admin;
     }
 
+    void stopClient();
+
   private:
-    void run();
+    friend class Shard;
+
+    // co_await readLine() / readFrame(): the next line or frame, valid
+    // until the session's next co_await.
+    struct LineAwaiter {
+        ClientHandler& client;
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> session);
+        std::string_view await_resume();
+    };
+    struct FrameAwaiter {
+        ClientHandler& client;
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> session);
+        const WireProtocol::FrameView& await_resume();
+    };
+    // co_await drained(): while the client is congested, waits until its
+    // queue drains to the low-water mark.
+    struct DrainAwaiter {
+        ClientHandler& client;
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> session);
+        void await_resume() {}
+    };
+
+    LineAwaiter readLine() {
+        return {*this};
+    }
+    FrameAwaiter readFrame() {
+        return {*this};
+    }
+    DrainAwaiter drained() {
+        return {*this};
+    }
+
+    // What flood control does with the next line or frame.
+    enum class Admission {
+        Admit,
+        Delay,
+        Drop
+    };
+
+    Session textSession();
+    Session binarySession();
+
     void handleMessage(const std::string& msg);
-    std::mutex socket_mutex_;
+    bool negotiate();
+    bool negotiate(const char*& data, size_t& size);
+    void negotiated();
+    void enableBinary();
+    void receive(const char* data, size_t size);
+    void consume(size_t bytes);
+    void readFailed(int error);
+    void input(std::string_view line);
+    void input(const WireProtocol::FrameView& frame);
+    void hold(std::string bytes);
+    bool nextHeld();
+    Admission admit(size_t bytes, bool leaving);
+    void floodTimer();
+    void watchIdle();
+    void idleTimer();
+    void linger();
+    void resumeWriter();
+    void dispatch(std::string_view line);
+    void dispatch(const WireProtocol::FrameView& frame);
+    void post(WorkerPool& workers, Payload message);
+    void dispatchInbox();
+    void handleLine(std::string_view raw_msg);
+    void handleFrame(const WireProtocol::FrameView& frame);
+    void leave();
+    void enqueue(const Payload& payload);
+    void enqueue(const Payload* payloads, size_t count, Traffic traffic);
+    void discardOutbound();
+    void discardOutboundLocked();
+    void scheduleFlush();
+    bool writePending();
+    void disconnect();
+    std::string nicknameCopy() const;
+    LineFramer framer_;
+    std::unique_ptr<FrameDecoder> decoder_;
+    bool negotiated_ = false;
+    Session session_;
+    // Set while the session is suspended in readLine()/readFrame() or send().
+    std::coroutine_handle<> reader_;
+    std::coroutine_handle<> writer_;
+    // Input that arrived while the session was waiting in drained() or was
+    // throttled; a client is dropped once this passes the high-water mark.
+    // Entries before held_head_ are already taken. A vector, unlike a
+    // deque, allocates nothing until something is held.
+    std::vector<std::string> held_;
+    size_t held_head_ = 0;
+    size_t held_bytes_ = 0;
+    std::string current_;
+    std::string_view line_;
+    WireProtocol::FrameView frame_{};
+    TokenBucket message_bucket_;
+    TokenBucket byte_bucket_;
+    bool flood_timer_armed_ = false;
+    uint64_t flood_warned_ns_ = 0;
+    // Metrics::nowNs() at the last read and the last keepalive sent.
+    uint64_t last_input_ns_ = 0;
+    uint64_t last_ping_ns_ = 0;
+    bool lingering_ = false;
+    // Lines or frames waiting for a worker, when dispatch runs on the
+    // server's worker pool; at most one worker holds them at a time.
+    std::mutex inbox_mutex_;
+    std::vector<Payload> inbox_;
+    std::vector<Payload> dispatching_;
+    bool dispatch_scheduled_ = false;
+    // disconnect() left the removal to the worker holding the inbox.
+    bool removal_deferred_ = false;
+    // Preamble bytes matched so far when the backend hands over data.
+    size_t preamble_matched_ = 0;
+    std::atomic<bool> binary_{false};
+    std::mutex outbound_mutex_;
+    OutboundQueue outbound_;
+    size_t dropped_messages_ = 0;
+    // When the queue last went over its high-water mark; 0 while it keeps up.
+    uint64_t congested_since_ns_ = 0;
+    bool flush_scheduled_ = false;
+    uint64_t flush_requested_ns_ = 0;
     bool prompt_pending_ = true;
+    bool removal_scheduled_ = false;
     int client_socket_;
-    std::string nickname_;
     ChatServer* server_;
-    std::unique_ptr<std::thread> thread_;
-    bool active_;
-};
\ No newline at end of file
+    Shard* shard_;
+    size_t shard_slot_ = 0;
+    std::atomic<bool> active_;
+    bool admin_ = false;
+    // Taken by setNickname() and nicknameCopy() only; the thread handling
+    // the client's messages reads nickname_ directly.
+    mutable std::mutex nickname_mutex_;
+    std::string nickname_;
+    std::vector<std::string> rooms_;
+};
@@ -0,0 +1,106 @@
+#include "ClientRegistry.h"
+#include <algorithm>
+#include <functional>
+
+ClientRegistry::Stripe& ClientRegistry::stripeFor(const std::string& nickname) {
+    return stripes_[std::hash<std::string>()(nickname) % kStripes];
+}
+
+const ClientRegistry::Stripe& ClientRegistry::stripeFor(const std::string& nickname) const {
+    return stripes_[std::hash<std::string>()(nickname) % kStripes];
+}
+
+void ClientRegistry::changed() {
+    version_.fetch_add(1, std::memory_order_release);
+}
+
+bool ClientRegistry::add(const std::string& nickname, ClientPtr client) {
+    Stripe& stripe = stripeFor(nickname);
+    {
+        std::unique_lock<std::shared_mutex> lock(stripe.mtx);
+        if(!stripe.clients.emplace(nickname, std::move(client)).second) {
+            return false;
+        }
+    }
+    ++size_;
+    changed();
+    return true;
+}
+
+bool ClientRegistry::remove(const std::string& nickname, const ClientHandler* client) {
+    Stripe& stripe = stripeFor(nickname);
+    {
+        std::unique_lock<std::shared_mutex> lock(stripe.mtx);
+        auto it = stripe.clients.find(nickname);
+        if(it == stripe.clients.end() || it->second.get() != client) return false;
+        stripe.clients.erase(it);
+    }
+    --size_;
+    changed();
+    return true;
+}
+
+bool ClientRegistry::rename(const std::string& from, const std::string& to, const ClientPtr& client) {
+    if(from == to) return true;
+
+    // Claim the new name first so a concurrent rename cannot take it; for a
+    // moment both names resolve to the client, which is harmless.
+    if(!add(to, client)) return false;
+    remove(from, client.get());
+    return true;
+}
+
+ClientRegistry::ClientPtr ClientRegistry::find(const std::string& nickname) const {
+    const Stripe& stripe = stripeFor(nickname);
+    std::shared_lock<std::shared_mutex> lock(stripe.mtx);
+    auto it = stripe.clients.find(nickname);
+    return it == stripe.clients.end() ? nullptr : it->second;
+}
+
+bool ClientRegistry::contains(const std::string& nickname) const {
+    const Stripe& stripe = stripeFor(nickname);
+    std::shared_lock<std::shared_mutex> lock(stripe.mtx);
+    return stripe.clients.count(nickname) != 0;
+}
+
+std::shared_ptr<const ClientRegistry::Snapshot> ClientRegistry::snapshot() const {
+    uint64_t version = version_.load(std::memory_order_acquire);
+    if(snapshot_version_.load(std::memory_order_acquire) == version) {
+        auto current = std::atomic_load(&snapshot_);
+        if(current) return current;
+    }
+
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    version = version_.load(std::memory_order_acquire);
+    if(snapshot_version_.load(std::memory_order_relaxed) == version && snapshot_) {
+        return snapshot_;
+    }
+
+    auto fresh = std::make_shared<Snapshot>();
+    fresh->reserve(size_);
+    for(const Stripe& stripe : stripes_) {
+        std::shared_lock<std::shared_mutex> stripe_lock(stripe.mtx);
+        for(const auto& [nickname, client] : stripe.clients) {
+            fresh->push_back({nickname, client});
+        }
+    }
+    std::sort(fresh->begin(), fresh->end(), [](const Entry& a, const Entry& b) {
+        return a.nickname < b.nickname;
+    });
+
+    // Publishing the version read before the scan means a change made
+    // during it leaves the snapshot stale and the next reader rebuilds.
+    std::shared_ptr<const Snapshot> published = std::move(fresh);
+    std::atomic_store(&snapshot_, published);
+    snapshot_version_.store(version, std::memory_order_release);
+    return published;
+}
+
+void ClientRegistry::clear() {
+    for(Stripe& stripe : stripes_) {
+        std::unique_lock<std::shared_mutex> lock(stripe.mtx);
+        stripe.clients.clear();
+    }
+    size_ = 0;
+    changed();
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class ClientHandler;
+
+// Nickname -> client index shared by all reactor shards. Lookups hash the
+// nickname to one of kStripes independently locked maps, so PMs and nick
+// changes on different shards rarely meet on the same lock. Whole-registry
+// readers (/users, shutdown) take an immutable snapshot that is rebuilt
+// only after the registry has changed, and is swapped in atomically.
+class ClientRegistry {
+  public:
+    using ClientPtr = std::shared_ptr<ClientHandler>;
+
+    struct Entry {
+        std::string nickname;
+        std::weak_ptr<ClientHandler> client;
+    };
+    // Sorted by nickname.
+    using Snapshot = std::vector<Entry>;
+
+    static constexpr size_t kStripes = 16;
+
+    // Returns false if the nickname is already taken.
+    bool add(const std::string& nickname, ClientPtr client);
+    // Removes nickname only while it still belongs to client.
+    bool remove(const std::string& nickname, const ClientHandler* client);
+    // Moves client from one nickname to another; false if `to` is taken.
+    bool rename(const std::string& from, const std::string& to, const ClientPtr& client);
+    ClientPtr find(const std::string& nickname) const;
+    bool contains(const std::string& nickname) const;
+
+    std::shared_ptr<const Snapshot> snapshot() const;
+    size_t size() const {
+        return size_;
+    }
+    void clear();
+
+  private:
+    struct Stripe {
+        mutable std::shared_mutex mtx;
+        std::unordered_map<std::string, ClientPtr> clients;
+    };
+
+    Stripe& stripeFor(const std::string& nickname);
+    const Stripe& stripeFor(const std::string& nickname) const;
+    void changed();
+
+    std::array<Stripe, kStripes> stripes_;
+    std::atomic<size_t> size_{0};
+    std::atomic<uint64_t> version_{0};
+
+    mutable std::mutex snapshot_mutex_;
+    mutable std::shared_ptr<const Snapshot> snapshot_;
+    mutable std::atomic<uint64_t> snapshot_version_{~uint64_t(0)};
+};
@@ -0,0 +1,109 @@
+#include "EpollBackend.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+EpollBackend::EpollBackend() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)), events_(256) {
+    if(epoll_fd_ < 0) {
+        throw std::runtime_error("epoll_create1 failed: " + std::string(strerror(errno)));
+    }
+}
+
+EpollBackend::~EpollBackend() {
+    if(epoll_fd_ != -1) {
+        close(epoll_fd_);
+    }
+}
+
+void EpollBackend::watch(int fd, Handler handler) {
+    add(fd, EPOLLIN, [handler = std::move(handler)](uint32_t) {
+        handler();
+    });
+}
+
+void EpollBackend::listen(int fd, AcceptHandler handler) {
+    add(fd, EPOLLIN | EPOLLET, [fd, handler = std::move(handler)](uint32_t) {
+        while(true) {
+            int socket = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(socket < 0) {
+                if(errno == EINTR) continue;
+                if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                    handler(-errno);
+                }
+                return;
+            }
+            handler(socket);
+        }
+    });
+}
+
+void EpollBackend::add(int fd, std::shared_ptr<IoConnection> connection) {
+    add(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, [connection = std::move(connection)](uint32_t events) {
+        if(events & EPOLLOUT) {
+            connection->onWritable();
+        }
+        if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            connection->onReadable(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR));
+        }
+    });
+}
+
+void EpollBackend::add(int fd, uint32_t events, EventHandler handler) {
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    if(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        throw std::runtime_error("epoll_ctl(ADD) failed: " + std::string(strerror(errno)));
+    }
+    handlers_[fd] = std::move(handler);
+}
+
+void EpollBackend::remove(int fd) {
+    auto it = handlers_.find(fd);
+    if(it == handlers_.end()) return;
+
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    // The handler may be the one currently running, so keep it alive
+    // until the current batch of events has been dispatched. Outside a
+    // batch it goes now: the loop may not wake up again for a long time.
+    if(dispatching_) {
+        retired_.push_back(std::move(it->second));
+    }
+    handlers_.erase(it);
+}
+
+void EpollBackend::clear() {
+    for(auto& [fd, handler] : handlers_) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    handlers_.clear();
+    retired_.clear();
+}
+
+int EpollBackend::poll(int timeout_ms) {
+    int ready = epoll_wait(epoll_fd_, events_.data(), static_cast<int>(events_.size()), timeout_ms);
+    if(ready < 0) {
+        if(errno == EINTR) return 0;
+        throw std::runtime_error("epoll_wait failed: " + std::string(strerror(errno)));
+    }
+
+    dispatching_ = true;
+    for(int i = 0; i < ready; ++i) {
+        auto it = handlers_.find(events_[i].data.fd);
+        if(it != handlers_.end()) {
+            it->second(events_[i].events);
+        }
+    }
+    dispatching_ = false;
+    retired_.clear();
+
+    if(ready == static_cast<int>(events_.size())) {
+        events_.resize(events_.size() * 2);
+    }
+    return ready;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <sys/epoll.h>
+#include "IoBackend.h"
+
+// Readiness-based backend: edge-triggered epoll for connections and the
+// listener, level-triggered for watched descriptors.
+class EpollBackend : public IoBackend {
+  public:
+    EpollBackend();
+    ~EpollBackend() override;
+    EpollBackend(const EpollBackend&) = delete;
+    EpollBackend& operator=(const EpollBackend&) = delete;
+
+    const char* name() const override {
+        return "epoll";
+    }
+    void watch(int fd, Handler handler) override;
+    void listen(int fd, AcceptHandler handler) override;
+    void add(int fd, std::shared_ptr<IoConnection> connection) override;
+    void waitWritable(int fd) override {
+        // EPOLLOUT is part of every connection's edge-triggered interest set.
+        (void)fd;
+    }
+    void remove(int fd) override;
+    void clear() override;
+    int poll(int timeout_ms) override;
+    size_t size() const override {
+        return handlers_.size();
+    }
+
+  private:
+    using EventHandler = std::function<void(uint32_t events)>;
+
+    void add(int fd, uint32_t events, EventHandler handler);
+
+    int epoll_fd_;
+    std::unordered_map<int, EventHandler> handlers_;
+    std::vector<EventHandler> retired_;
+    bool dispatching_ = false;
+    std::vector<epoll_event> events_;
+};
@@ -0,0 +1,73 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+
+// What happens to a line or frame that a client sends faster than its
+// token buckets allow.
+enum class FloodPolicy {
+    // Hold it (and everything after it) until the buckets refill.
+    Throttle,
+    // Discard it.
+    Drop,
+    // Close the connection.
+    Disconnect
+};
+
+// Every client gets one bucket for messages and one for bytes; a message
+// is dispatched once both hold enough tokens. A rate of 0 turns that
+// bucket off.
+struct FloodConfig {
+    double messages_per_sec = 20;
+    double message_burst = 60;
+    double bytes_per_sec = 16 * 1024;
+    double byte_burst = 64 * 1024;
+    FloodPolicy policy = FloodPolicy::Throttle;
+};
+
+// Accepts throttle, drop or disconnect.
+inline bool parseFloodPolicy(std::string_view name, FloodPolicy& policy) {
+    if(name == "throttle") {
+        policy = FloodPolicy::Throttle;
+    } else if(name == "drop") {
+        policy = FloodPolicy::Drop;
+    } else if(name == "disconnect") {
+        policy = FloodPolicy::Disconnect;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Starts full and refills continuously from the monotonic clock, so there
+// is no timer per bucket: each check just credits the time since the last.
+class TokenBucket {
+  public:
+    TokenBucket() = default;
+    TokenBucket(double rate, double burst) : rate_(rate), burst_(burst), tokens_(burst) {}
+
+    // Nanoseconds until amount tokens are available; 0 if they are now.
+    // An amount above the burst only needs a full bucket.
+    uint64_t wait(double amount, uint64_t now_ns) {
+        if(rate_ <= 0) return 0;
+        if(updated_ns_ != 0 && now_ns > updated_ns_) {
+            tokens_ = std::min(burst_, tokens_ + static_cast<double>(now_ns - updated_ns_) * rate_ / 1e9);
+        }
+        updated_ns_ = now_ns;
+
+        amount = std::min(amount, burst_);
+        if(tokens_ >= amount) return 0;
+        return static_cast<uint64_t>((amount - tokens_) / rate_ * 1e9) + 1;
+    }
+    // Call after wait() returned 0 for the same amount.
+    void take(double amount) {
+        if(rate_ <= 0) return;
+        tokens_ -= std::min(amount, burst_);
+    }
+
+  private:
+    double rate_ = 0;
+    double burst_ = 0;
+    double tokens_ = 0;
+    uint64_t updated_ns_ = 0;
+};
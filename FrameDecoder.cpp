@@ -0,0 +1,23 @@
+#include "FrameDecoder.h"
+
+// Buffers of the default size are recycled between binary clients; a
+// handful is enough, as most clients are terminals.
+static BlockPool& bufferPool() {
+    static BlockPool pool("frame buffers", WireProtocol::kMaxFrameSize, 64);
+    return pool;
+}
+
+FrameDecoder::FrameDecoder(size_t max_frame) : buffer_(bufferPool(), max_frame) {}
+
+std::pair<char*, size_t> FrameDecoder::writable() {
+    if(tail_ == buffer_.size() && head_ > 0) {
+        memmove(buffer_.data(), buffer_.data() + head_, tail_ - head_);
+        tail_ -= head_;
+        head_ = 0;
+    }
+    return {buffer_.data() + tail_, buffer_.size() - tail_};
+}
+
+void FrameDecoder::commit(size_t bytes) {
+    tail_ += bytes;
+}
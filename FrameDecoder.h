@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include "BlockPool.h"
+#include "WireProtocol.h"
+
+class FrameDecoder {
+  public:
+    explicit FrameDecoder(size_t max_frame = WireProtocol::kMaxFrameSize);
+
+    std::pair<char*, size_t> writable();
+    void commit(size_t bytes);
+
+    // Calls on_frame for every complete frame; the views point into the
+    // decoder's buffer and stay valid only for the duration of the call.
+    template <typename FrameHandler, typename ErrorHandler>
+    void extract(FrameHandler&& on_frame, ErrorHandler&& on_error);
+
+  private:
+    PooledBuffer buffer_;
+    size_t head_ = 0;
+    size_t tail_ = 0;
+};
+
+template <typename FrameHandler, typename ErrorHandler>
+void FrameDecoder::extract(FrameHandler&& on_frame, ErrorHandler&& on_error) {
+    while(head_ < tail_) {
+        WireProtocol::FrameView frame;
+        size_t consumed = 0;
+        auto result = WireProtocol::parse(buffer_.data() + head_, tail_ - head_, frame, consumed);
+
+        if(result == WireProtocol::ParseResult::Incomplete) break;
+        if(result == WireProtocol::ParseResult::Invalid) {
+            head_ = tail_;
+            on_error();
+            break;
+        }
+
+        head_ += consumed;
+        on_frame(frame);
+    }
+
+    if(head_ == tail_) {
+        head_ = 0;
+        tail_ = 0;
+    }
+}
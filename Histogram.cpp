@@ -0,0 +1,68 @@
+#include "Histogram.h"
+#include <algorithm>
+#include <cmath>
+
+Histogram::Histogram() : counts_(std::make_unique<std::atomic<uint64_t>[]>(kBuckets)) {
+    reset();
+}
+
+size_t Histogram::index(uint64_t value) {
+    if(value < kSub) return value;
+    int shift = 63 - __builtin_clzll(value) - kSubBits;
+    return (shift + 1) * kSub + ((value >> shift) & (kSub - 1));
+}
+
+uint64_t Histogram::upperBound(size_t index) {
+    if(index < kSub) return index;
+    int shift = static_cast<int>(index / kSub) - 1;
+    uint64_t base = (kSub + index % kSub) << shift;
+    return base + (uint64_t(1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+    counts_[index(value)].fetch_add(1, std::memory_order_relaxed);
+    total_.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t current = max_.load(std::memory_order_relaxed);
+    while(value > current && !max_.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void Histogram::merge(const Histogram& other) {
+    uint64_t merged = 0;
+    for(size_t i = 0; i < kBuckets; ++i) {
+        uint64_t count = other.counts_[i].load(std::memory_order_relaxed);
+        if(count == 0) continue;
+        counts_[i].fetch_add(count, std::memory_order_relaxed);
+        merged += count;
+    }
+    // Counting from the buckets keeps total consistent with them even while
+    // other is still being written to.
+    total_.fetch_add(merged, std::memory_order_relaxed);
+
+    uint64_t other_max = other.max();
+    uint64_t current = max_.load(std::memory_order_relaxed);
+    while(other_max > current && !max_.compare_exchange_weak(current, other_max, std::memory_order_relaxed)) {
+    }
+}
+
+void Histogram::reset() {
+    for(size_t i = 0; i < kBuckets; ++i) {
+        counts_[i].store(0, std::memory_order_relaxed);
+    }
+    total_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::percentile(double p) const {
+    uint64_t total = count();
+    if(total == 0) return 0;
+
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p / 100.0 * total)));
+    uint64_t seen = 0;
+    for(size_t i = 0; i < kBuckets; ++i) {
+        seen += counts_[i].load(std::memory_order_relaxed);
+        if(seen >= rank) return std::min(upperBound(i), max());
+    }
+    return max();
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Log-linear (HDR-style) histogram of non-negative values: 32 linear
+// sub-buckets per power of two, so every value is reported to within ~3%
+// over the full 64-bit range in a fixed 1920 buckets. Recording is a
+// relaxed atomic increment, so readers may merge while writers record.
+class Histogram {
+  public:
+    static constexpr int kSubBits = 5;
+    static constexpr size_t kSub = size_t(1) << kSubBits;
+    static constexpr size_t kBuckets = (64 - kSubBits + 1) * kSub;
+
+    Histogram();
+
+    void record(uint64_t value);
+    void merge(const Histogram& other);
+    void reset();
+
+    // Upper bound of the bucket holding the p-th percentile (0 < p <= 100).
+    uint64_t percentile(double p) const;
+    uint64_t count() const {
+        return total_.load(std::memory_order_relaxed);
+    }
+    uint64_t max() const {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    static size_t index(uint64_t value);
+    static uint64_t upperBound(size_t index);
+
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+    std::atomic<uint64_t> total_{0};
+    std::atomic<uint64_t> max_{0};
+};
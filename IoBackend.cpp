@@ -0,0 +1,37 @@
+#include "IoBackend.h"
+#include "EpollBackend.h"
+#include "UringBackend.h"
+#include <exception>
+
+bool parseIoBackend(std::string_view name, IoBackendKind& kind) {
+    if(name == "epoll") {
+        kind = IoBackendKind::Epoll;
+    } else if(name == "io_uring" || name == "uring") {
+        kind = IoBackendKind::IoUring;
+    } else if(name == "auto") {
+        kind = IoBackendKind::Auto;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const std::string& IoBackend::uringUnsupported() {
+    // Checked once by setting up (and tearing down) a full ring.
+    static const std::string reason = [] {
+        try {
+            UringBackend probe;
+        } catch(const std::exception& e) {
+            return std::string(e.what());
+        }
+        return std::string();
+    }();
+    return reason;
+}
+
+std::unique_ptr<IoBackend> IoBackend::create(IoBackendKind kind) {
+    if(kind != IoBackendKind::Epoll && uringUnsupported().empty()) {
+        return std::make_unique<UringBackend>();
+    }
+    return std::make_unique<EpollBackend>();
+}
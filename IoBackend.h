@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+enum class IoBackendKind {
+    Epoll,
+    IoUring,
+    // io_uring where the kernel supports it, epoll otherwise.
+    Auto
+};
+
+// Accepts epoll, io_uring or auto; leaves kind untouched otherwise.
+bool parseIoBackend(std::string_view name, IoBackendKind& kind);
+
+// A connected socket registered with a backend. Readiness backends (epoll)
+// call onReadable() and leave the reading to the connection; completion
+// backends (io_uring) read the socket themselves and call onReceived().
+// Writes are always made by the connection, which asks for onWritable()
+// through IoBackend::waitWritable() once the socket is full.
+class IoConnection {
+  public:
+    virtual ~IoConnection() = default;
+    // hung_up: the event also reported that the peer closed its side.
+    virtual void onReadable(bool hung_up) = 0;
+    // size > 0: bytes read, valid only during the call; 0: end of stream;
+    // negative: -errno.
+    virtual void onReceived(const char* data, ssize_t size) = 0;
+    virtual void onWritable() = 0;
+};
+
+// The socket I/O layer of one shard: the listening socket, the shard's
+// wake-up eventfd and every client connection. All calls come from the
+// shard's thread (or from whoever drives a shard without one).
+class IoBackend {
+  public:
+    using Handler = std::function<void()>;
+    // socket is the accepted connection, non-blocking and close-on-exec,
+    // or -errno when accepting failed.
+    using AcceptHandler = std::function<void(int socket)>;
+
+    virtual ~IoBackend() = default;
+
+    // Epoll when asked for, or when io_uring was asked for (or Auto) and
+    // uringUnsupported() is not empty.
+    static std::unique_ptr<IoBackend> create(IoBackendKind kind);
+    // Why this kernel cannot run the io_uring backend; empty if it can.
+    static const std::string& uringUnsupported();
+
+    virtual const char* name() const = 0;
+
+    // Calls handler whenever fd is readable (level-triggered).
+    virtual void watch(int fd, Handler handler) = 0;
+    virtual void listen(int fd, AcceptHandler handler) = 0;
+    virtual void add(int fd, std::shared_ptr<IoConnection> connection) = 0;
+    // The last write to fd hit EAGAIN; onWritable() follows once it can continue.
+    virtual void waitWritable(int fd) = 0;
+    virtual void remove(int fd) = 0;
+    virtual void clear() = 0;
+
+    // Waits up to timeout_ms (-1: indefinitely) and dispatches what arrived;
+    // returns the number of events handled.
+    virtual int poll(int timeout_ms) = 0;
+    virtual size_t size() const = 0;
+};
@@ -0,0 +1,303 @@
+#include "Journal.h"
+#include "Log.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+static std::string segmentPath(const std::string& directory, uint64_t first_seq, const char* extension) {
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu%s", static_cast<unsigned long long>(first_seq), extension);
+    return (fs::path(directory) / name).string();
+}
+
+// Maps size bytes of path. A new file is created and its blocks reserved up
+// front, so running out of disk fails here instead of raising SIGBUS on a
+// later write through the mapping.
+static void* mapFile(const std::string& path, size_t size, bool create) {
+    if(size == 0) return nullptr;
+
+    int fd = open(path.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        throw std::runtime_error("Failed to open " + path + ": " + strerror(errno));
+    }
+    if(create) {
+        int err = posix_fallocate(fd, 0, static_cast<off_t>(size));
+        if(err != 0 && (err != EOPNOTSUPP || ftruncate(fd, static_cast<off_t>(size)) < 0)) {
+            close(fd);
+            throw std::runtime_error("Failed to allocate " + path + ": " + strerror(err));
+        }
+    }
+
+    void* mapped = mmap(nullptr, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED) {
+        throw std::runtime_error("Failed to map " + path + ": " + strerror(errno));
+    }
+    return mapped;
+}
+
+static size_t fileSize(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+}
+
+struct Journal::Segment {
+    uint64_t first_seq = 0;
+    std::string data_path;
+    std::string index_path;
+    char* data = nullptr;
+    size_t data_capacity = 0;
+    size_t data_size = 0;
+    IndexEntry* index = nullptr;
+    size_t index_capacity = 0;
+    size_t count = 0;
+
+    ~Segment() {
+        unmap();
+    }
+
+    // Trims both files to their contents and returns the segment mapped
+    // read-only; this one is left mapped as it was, even if that fails. An
+    // empty segment is deleted instead, returning nullptr.
+    std::shared_ptr<Segment> seal() const {
+        if(count == 0) {
+            unlink(data_path.c_str());
+            unlink(index_path.c_str());
+            return nullptr;
+        }
+
+        if(truncate(data_path.c_str(), static_cast<off_t>(data_size)) < 0 ||
+           truncate(index_path.c_str(), static_cast<off_t>(count * sizeof(IndexEntry))) < 0) {
+            throw std::runtime_error("Failed to seal journal segment " + data_path + ": " + strerror(errno));
+        }
+        auto sealed = std::make_shared<Segment>();
+        sealed->first_seq = first_seq;
+        sealed->data_path = data_path;
+        sealed->index_path = index_path;
+        sealed->data_capacity = data_size;
+        sealed->data_size = data_size;
+        sealed->index_capacity = count;
+        sealed->count = count;
+        sealed->data = static_cast<char*>(mapFile(data_path, data_size, false));
+        sealed->index = static_cast<IndexEntry*>(mapFile(index_path, count * sizeof(IndexEntry), false));
+        return sealed;
+    }
+
+    void unmap() {
+        if(data) munmap(data, data_capacity);
+        if(index) munmap(index, index_capacity * sizeof(IndexEntry));
+        data = nullptr;
+        index = nullptr;
+    }
+
+    // size is the data size the caller saw, since an active segment's grows
+    // while it reads.
+    Record record(size_t i, size_t size) const {
+        const IndexEntry& entry = index[i];
+        Record record{entry.timestamp_ms, {}, {}};
+        size_t consumed = 0;
+        WireProtocol::parse(data + entry.offset, size - entry.offset, record.frame, consumed);
+        record.bytes = std::string_view(data + entry.offset, consumed);
+        return record;
+    }
+};
+
+Journal::Journal(const std::string& directory, size_t segment_bytes, size_t max_segments)
+    : directory_(directory), segment_bytes_(segment_bytes),
+      index_capacity_(std::max<size_t>(1, segment_bytes / 64)), max_segments_(std::max<size_t>(1, max_segments)) {
+    fs::create_directories(directory_);
+
+    std::vector<uint64_t> existing;
+    for(const auto& file : fs::directory_iterator(directory_)) {
+        if(file.path().extension() != ".idx") continue;
+        const std::string stem = file.path().stem().string();
+        uint64_t seq = 0;
+        auto result = std::from_chars(stem.data(), stem.data() + stem.size(), seq);
+        if(result.ec == std::errc() && result.ptr == stem.data() + stem.size()) {
+            existing.push_back(seq);
+        }
+    }
+    std::sort(existing.begin(), existing.end());
+    for(uint64_t seq : existing) {
+        load(seq);
+    }
+
+    roll();
+}
+
+Journal::~Journal() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    try {
+        sealActive();
+    } catch(const std::exception& e) {
+        Log::error(e.what());
+    }
+}
+
+void Journal::load(uint64_t first_seq) {
+    auto segment = std::make_unique<Segment>();
+    segment->first_seq = first_seq;
+    segment->data_path = segmentPath(directory_, first_seq, ".log");
+    segment->index_path = segmentPath(directory_, first_seq, ".idx");
+    segment->data_capacity = fileSize(segment->data_path);
+    segment->index_capacity = fileSize(segment->index_path) / sizeof(IndexEntry);
+    segment->data = static_cast<char*>(mapFile(segment->data_path, segment->data_capacity, false));
+    segment->index = static_cast<IndexEntry*>(mapFile(segment->index_path,
+                                                      segment->index_capacity * sizeof(IndexEntry), false));
+
+    // Timestamps are never 0, so the written entries are the non-zero prefix
+    // of a preallocated index. A crash may leave the last one pointing at a
+    // record that was not completely written.
+    IndexEntry* end = segment->index + segment->index_capacity;
+    segment->count = std::partition_point(segment->index, end, [](const IndexEntry& entry) {
+        return entry.timestamp_ms != 0;
+    }) - segment->index;
+
+    while(segment->count > 0) {
+        const IndexEntry& last = segment->index[segment->count - 1];
+        WireProtocol::FrameView frame;
+        size_t consumed = 0;
+        if(last.offset < segment->data_capacity &&
+           WireProtocol::parse(segment->data + last.offset, segment->data_capacity - last.offset, frame,
+                               consumed) == WireProtocol::ParseResult::Ok) {
+            segment->data_size = last.offset + consumed;
+            break;
+        }
+        --segment->count;
+    }
+
+    std::shared_ptr<Segment> sealed = segment->seal();
+    if(!sealed) return;
+    next_seq_ = first_seq + sealed->count;
+    last_timestamp_ms_ = std::max(last_timestamp_ms_, sealed->index[sealed->count - 1].timestamp_ms);
+    segments_.push_back(std::move(sealed));
+}
+
+// A segment that fails to seal is not written to again; it stays readable
+// as it is, and the next start trims it.
+void Journal::sealActive() {
+    if(!active_) return;
+    std::shared_ptr<Segment> sealed = std::exchange(active_, nullptr)->seal();
+    if(sealed) {
+        segments_.back() = std::move(sealed);
+    } else {
+        segments_.pop_back();
+    }
+}
+
+void Journal::roll() {
+    sealActive();
+
+    auto segment = std::make_shared<Segment>();
+    segment->first_seq = next_seq_;
+    segment->data_path = segmentPath(directory_, next_seq_, ".log");
+    segment->index_path = segmentPath(directory_, next_seq_, ".idx");
+    segment->data_capacity = segment_bytes_;
+    segment->index_capacity = index_capacity_;
+    try {
+        segment->data = static_cast<char*>(mapFile(segment->data_path, segment->data_capacity, true));
+        segment->index = static_cast<IndexEntry*>(mapFile(segment->index_path,
+                                                          segment->index_capacity * sizeof(IndexEntry), true));
+    } catch(...) {
+        unlink(segment->data_path.c_str());
+        unlink(segment->index_path.c_str());
+        throw;
+    }
+    active_ = segment.get();
+    segments_.push_back(std::move(segment));
+    trim();
+}
+
+// Deletes the oldest segments beyond max_segments_. A scan that still
+// reads one keeps it mapped until it is done.
+void Journal::trim() {
+    if(segments_.size() <= max_segments_) return;
+
+    const auto excess = segments_.begin() + static_cast<ptrdiff_t>(segments_.size() - max_segments_);
+    for(auto segment = segments_.begin(); segment != excess; ++segment) {
+        unlink((*segment)->data_path.c_str());
+        unlink((*segment)->index_path.c_str());
+    }
+    segments_.erase(segments_.begin(), excess);
+}
+
+// A journal that cannot start a new segment (disk full, say) must not break
+// the broadcast being journaled: the error is logged, and appends are
+// dropped until the next attempt kRetryMs later.
+void Journal::append(const Payload& frame, uint64_t timestamp_ms) {
+    if(frame.empty() || frame.size() > segment_bytes_) return;
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if(!active_ || active_->data_size + frame.size() > active_->data_capacity ||
+       active_->count == active_->index_capacity) {
+        if(timestamp_ms < retry_at_ms_) return;
+        try {
+            roll();
+        } catch(const std::exception& e) {
+            Log::error("Journal: ", e.what(), "; dropping messages for ", kRetryMs / 1000, " s");
+            retry_at_ms_ = timestamp_ms + kRetryMs;
+            return;
+        }
+        retry_at_ms_ = 0;
+    }
+
+    // Keeps the index sorted (and non-zero) even if the wall clock steps back.
+    last_timestamp_ms_ = std::max(last_timestamp_ms_, timestamp_ms);
+
+    memcpy(active_->data + active_->data_size, frame.data(), frame.size());
+    active_->index[active_->count] = IndexEntry{active_->data_size, last_timestamp_ms_};
+    active_->data_size += frame.size();
+    ++active_->count;
+    ++next_seq_;
+}
+
+// Only taking the snapshot needs the lock. Each view keeps its segment
+// mapped, and the records it counts are never written again, even if the
+// segment is sealed or dropped while the caller reads.
+std::vector<Journal::View> Journal::snapshot() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    std::vector<View> views;
+    views.reserve(segments_.size());
+    for(const auto& segment : segments_) {
+        views.push_back({segment, segment->count, segment->data_size});
+    }
+    return views;
+}
+
+void Journal::scanBackward(const Visitor& visit, uint64_t since_ms) const {
+    const std::vector<View> views = snapshot();
+    for(auto view = views.rbegin(); view != views.rend(); ++view) {
+        for(size_t i = view->count; i-- > 0;) {
+            Record record = view->segment->record(i, view->data_size);
+            if(record.timestamp_ms < since_ms || !visit(record)) return;
+        }
+    }
+}
+
+size_t Journal::segmentCount() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return segments_.size();
+}
+
+uint64_t Journal::recordCount() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return segments_.empty() ? 0 : next_seq_ - segments_.front()->first_seq;
+}
+
+uint64_t Journal::nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Payload.h"
+#include "WireProtocol.h"
+
+// Append-only journal of chat messages, kept as a series of segments in one
+// directory. A segment is a pair of files named after the sequence number of
+// its first record:
+//   <seq>.log  the records back to back, each an encoded WireProtocol frame
+//   <seq>.idx  one IndexEntry (offset in .log, timestamp) per record
+// Both files of the active segment are preallocated and memory-mapped, so an
+// append is two memcpys under a mutex and no system calls. A segment is
+// sealed (trimmed to its contents and remapped read-only) once either file
+// is full, and a new one is started. Readers go through the index from the
+// newest record back, without holding up appends.
+class Journal {
+  public:
+    static constexpr size_t kSegmentBytes = 16 * 1024 * 1024;
+    // Segments kept, the active one included; older ones are deleted.
+    static constexpr size_t kMaxSegments = 64;
+    // How long appends are dropped after a new segment could not be created.
+    static constexpr uint64_t kRetryMs = 10'000;
+
+    struct IndexEntry {
+        uint64_t offset;
+        uint64_t timestamp_ms;
+    };
+
+    struct Record {
+        uint64_t timestamp_ms;
+        WireProtocol::FrameView frame;
+        // The encoded frame, as stored.
+        std::string_view bytes;
+    };
+
+    // Return false to stop the scan.
+    using Visitor = std::function<bool(const Record&)>;
+
+    // Opens directory, creating it if needed. Existing segments are sealed,
+    // dropping a torn last record left by a crash, and appends go to a new one.
+    explicit Journal(const std::string& directory, size_t segment_bytes = kSegmentBytes,
+                     size_t max_segments = kMaxSegments);
+    ~Journal();
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // frame must be a complete WireProtocol frame. Never throws; see kRetryMs.
+    void append(const Payload& frame, uint64_t timestamp_ms);
+    // Visits records newest first until visit returns false or a record is
+    // older than since_ms.
+    void scanBackward(const Visitor& visit, uint64_t since_ms = 0) const;
+
+    size_t segmentCount() const;
+    uint64_t recordCount() const;
+
+    static uint64_t nowMs();
+
+  private:
+    struct Segment;
+    // A segment's records as of snapshot().
+    struct View {
+        std::shared_ptr<const Segment> segment;
+        size_t count;
+        size_t data_size;
+    };
+
+    std::vector<View> snapshot() const;
+    void load(uint64_t first_seq);
+    void sealActive();
+    void roll();
+    void trim();
+
+    mutable std::mutex mtx_;
+    std::string directory_;
+    size_t segment_bytes_;
+    size_t index_capacity_;
+    size_t max_segments_;
+    std::vector<std::shared_ptr<Segment>> segments_;
+    Segment* active_ = nullptr;
+    uint64_t next_seq_ = 0;
+    uint64_t last_timestamp_ms_ = 1;
+    uint64_t retry_at_ms_ = 0;
+};
@@ -0,0 +1,61 @@
+#include "LineFramer.h"
+#include <algorithm>
+#include <cstring>
+
+// The ring holds two of the longest lines, rounded up to a power of two.
+static size_t ringCapacity(size_t max_line) {
+    size_t capacity = 64;
+    while(capacity < 2 * max_line) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+// Rings of the default size are recycled between connections; others come
+// from the heap.
+static BlockPool& ringPool() {
+    static BlockPool pool("line buffers", ringCapacity(LineFramer::kDefaultMaxLine), 1024);
+    return pool;
+}
+
+// scratch_ is only needed for a line that wraps around the ring, so it
+// grows on first use rather than with every connection.
+LineFramer::LineFramer(size_t max_line)
+    : buffer_(ringPool(), ringCapacity(max_line)), mask_(buffer_.size() - 1), max_line_(max_line) {}
+
+std::pair<char*, size_t> LineFramer::writable() {
+    size_t capacity = buffer_.size();
+    size_t free_bytes = capacity - (tail_ - head_);
+    size_t pos = tail_ & mask_;
+    return {buffer_.data() + pos, std::min(free_bytes, capacity - pos)};
+}
+
+void LineFramer::commit(size_t bytes) {
+    tail_ += bytes;
+}
+
+size_t LineFramer::find(size_t from, size_t to) const {
+    while(from < to) {
+        size_t pos = from & mask_;
+        size_t len = std::min(to - from, buffer_.size() - pos);
+        const void* hit = memchr(buffer_.data() + pos, '\n', len);
+        if(hit) {
+            return from + (static_cast<const char*>(hit) - (buffer_.data() + pos));
+        }
+        from += len;
+    }
+    return to;
+}
+
+std::string_view LineFramer::view(size_t begin, size_t end) {
+    size_t pos = begin & mask_;
+    size_t len = end - begin;
+    if(pos + len <= buffer_.size()) {
+        return std::string_view(buffer_.data() + pos, len);
+    }
+
+    size_t first = buffer_.size() - pos;
+    scratch_.assign(buffer_.data() + pos, first);
+    scratch_.append(buffer_.data(), len - first);
+    return scratch_;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "BlockPool.h"
+
+class LineFramer {
+  public:
+    static constexpr size_t kDefaultMaxLine = 4096;
+
+    explicit LineFramer(size_t max_line = kDefaultMaxLine);
+
+    std::pair<char*, size_t> writable();
+    void commit(size_t bytes);
+
+    // Calls on_line once per complete line (without the trailing "\r\n"),
+    // in arrival order. Lines longer than the limit are discarded up to the
+    // next newline and reported once through on_overflow.
+    template <typename LineHandler, typename OverflowHandler>
+    void extract(LineHandler&& on_line, OverflowHandler&& on_overflow);
+
+    size_t buffered() const {
+        return tail_ - head_;
+    }
+    size_t maxLine() const {
+        return max_line_;
+    }
+
+  private:
+    size_t find(size_t from, size_t to) const;
+    char at(size_t pos) const {
+        return buffer_[pos & mask_];
+    }
+    std::string_view view(size_t begin, size_t end);
+
+    PooledBuffer buffer_;
+    size_t mask_;
+    size_t max_line_;
+    size_t head_ = 0;
+    size_t scan_ = 0;
+    size_t tail_ = 0;
+    bool discarding_ = false;
+    std::string scratch_;
+};
+
+template <typename LineHandler, typename OverflowHandler>
+void LineFramer::extract(LineHandler&& on_line, OverflowHandler&& on_overflow) {
+    while(scan_ < tail_) {
+        size_t newline = find(scan_, tail_);
+        if(newline == tail_) {
+            scan_ = tail_;
+            if(tail_ - head_ > max_line_) {
+                if(!discarding_) {
+                    discarding_ = true;
+                    on_overflow();
+                }
+                head_ = tail_;
+            }
+            return;
+        }
+
+        size_t end = newline;
+        scan_ = newline + 1;
+
+        if(discarding_) {
+            discarding_ = false;
+            head_ = scan_;
+            continue;
+        }
+        if(end - head_ > max_line_) {
+            on_overflow();
+            head_ = scan_;
+            continue;
+        }
+
+        if(end > head_ && at(end - 1) == '\r') {
+            --end;
+        }
+        if(end > head_) {
+            on_line(view(head_, end));
+        }
+        head_ = scan_;
+    }
+}
@@ -0,0 +1,101 @@
+#include "Log.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+
+namespace Log {
+
+static std::atomic<LogLevel> runtime_level{LogLevel::Info};
+
+void setLevel(LogLevel level) {
+    runtime_level.store(level, std::memory_order_relaxed);
+}
+
+LogLevel level() {
+    return runtime_level.load(std::memory_order_relaxed);
+}
+
+LogLevel parseLevel(std::string_view name, LogLevel fallback) {
+    static const std::pair<std::string_view, LogLevel> names[] = {
+        {"trace", LogLevel::Trace}, {"debug", LogLevel::Debug}, {"info", LogLevel::Info},
+        {"warn", LogLevel::Warn},   {"error", LogLevel::Error}, {"off", LogLevel::Off}};
+    for(const auto& [candidate, level] : names) {
+        if(candidate == name) return level;
+    }
+    return fallback;
+}
+
+std::string_view timestamp() {
+    struct Cache {
+        int64_t second = -1;
+        int64_t millisecond = -1;
+        char text[32];
+        size_t length = 0;
+    };
+    thread_local Cache cache;
+
+    auto now = std::chrono::system_clock::now();
+    int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+    if(ms == cache.millisecond) {
+        return std::string_view(cache.text, cache.length);
+    }
+
+    int64_t second = ms / 1000;
+    if(second != cache.second) {
+        std::time_t in_time_t = static_cast<std::time_t>(second);
+        std::tm bt;
+        localtime_r(&in_time_t, &bt);
+        cache.length = strftime(cache.text, sizeof(cache.text), "%Y-%m-%d %H:%M:%S.000", &bt);
+        cache.second = second;
+    }
+
+    int milli = static_cast<int>(ms % 1000);
+    char* digits = cache.text + cache.length - 3;
+    digits[0] = static_cast<char>('0' + milli / 100);
+    digits[1] = static_cast<char>('0' + milli / 10 % 10);
+    digits[2] = static_cast<char>('0' + milli % 10);
+    cache.millisecond = ms;
+    return std::string_view(cache.text, cache.length);
+}
+
+namespace detail {
+
+static const char* levelName(LogLevel level) {
+    switch(level) {
+    case LogLevel::Trace:
+        return "TRACE";
+    case LogLevel::Debug:
+        return "DEBUG";
+    case LogLevel::Info:
+        return "INFO";
+    case LogLevel::Warn:
+        return "WARN";
+    default:
+        return "ERROR";
+    }
+}
+
+std::string& begin(LogLevel level) {
+    thread_local std::string line;
+    line.clear();
+    line += '[';
+    line.append(timestamp());
+    line += "] [";
+    line += levelName(level);
+    line += "] ";
+    return line;
+}
+
+void commit(LogLevel level, std::string& line) {
+    line += '\n';
+    FILE* stream = level >= LogLevel::Warn ? stderr : stdout;
+    fwrite(line.data(), 1, line.size(), stream);
+    if(level >= LogLevel::Warn) {
+        fflush(stream);
+    }
+}
+
+}
+
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <charconv>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+enum class LogLevel {
+    Trace,
+    Debug,
+    Info,
+    Warn,
+    Error,
+    Off
+};
+
+// Lowest level compiled in; calls below it are discarded at compile time,
+// arguments included. Set with -DCHAT_LOG_LEVEL=<0..5> (CMake option of the
+// same name), 0 = trace.
+#ifndef CHAT_LOG_LEVEL
+#define CHAT_LOG_LEVEL 2
+#endif
+
+// Console diagnostics: "[timestamp] [LEVEL] message" lines, info and below
+// on stdout, warn and error on stderr. Messages are built from their
+// arguments in a per-thread buffer and written with one call, so enabled
+// levels do not allocate once warm and disabled ones cost nothing.
+namespace Log {
+
+constexpr LogLevel kCompiledLevel = static_cast<LogLevel>(CHAT_LOG_LEVEL);
+
+void setLevel(LogLevel level);
+LogLevel level();
+// Accepts trace, debug, info, warn, error or off; returns fallback otherwise.
+LogLevel parseLevel(std::string_view name, LogLevel fallback);
+
+// "YYYY-MM-DD HH:MM:SS.mmm" for the current time. Each thread reformats it
+// at most once per millisecond (the date part once per second); the view
+// stays valid until the thread's next call.
+std::string_view timestamp();
+
+namespace detail {
+
+std::string& begin(LogLevel level);
+void commit(LogLevel level, std::string& line);
+
+inline void append(std::string& out, std::string_view text) {
+    out.append(text);
+}
+
+inline void append(std::string& out, const char* text) {
+    out.append(text);
+}
+
+inline void append(std::string& out, const std::string& text) {
+    out.append(text);
+}
+
+inline void append(std::string& out, char c) {
+    out += c;
+}
+
+template <typename T>
+std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, char> && !std::is_same_v<T, bool>>
+append(std::string& out, T value) {
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, result.ptr - buffer);
+}
+
+inline void append(std::string& out, bool value) {
+    out.append(value ? "true" : "false");
+}
+
+}
+
+template <LogLevel Level, typename... Args>
+inline void write(const Args&... args) {
+    if constexpr(Level >= kCompiledLevel && Level != LogLevel::Off) {
+        if(Level < level()) return;
+        std::string& line = detail::begin(Level);
+        (detail::append(line, args), ...);
+        detail::commit(Level, line);
+    }
+}
+
+template <typename... Args>
+inline void trace(const Args&... args) {
+    write<LogLevel::Trace>(args...);
+}
+
+template <typename... Args>
+inline void debug(const Args&... args) {
+    write<LogLevel::Debug>(args...);
+}
+
+template <typename... Args>
+inline void info(const Args&... args) {
+    write<LogLevel::Info>(args...);
+}
+
+template <typename... Args>
+inline void warn(const Args&... args) {
+    write<LogLevel::Warn>(args...);
+}
+
+template <typename... Args>
+inline void error(const Args&... args) {
+    write<LogLevel::Error>(args...);
+}
+
+}
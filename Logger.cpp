@@ -1,16 +1,43 @@
 #include "Logger.h"
+#include <cstdint>
 #include <iostream>
+#include <stdexcept>
 
 template <typename T>
-Logger<T>::Logger(const std::string& filename) {
+Logger<T>::Logger(const std::string& filename) : Logger(filename, LoggerOptions()) {}
+
+template <typename T>
+Logger<T>::Logger(const std::string& filename, const LoggerOptions& options) : options_(options) {
+    if(options_.async) {
+        // A file buffer as large as one batch turns each batch into a single write().
+        file_buffer_.resize(options_.flush_bytes);
+        logfile_.rdbuf()->pubsetbuf(file_buffer_.data(), file_buffer_.size());
+    }
+
     logfile_.open(filename, std::ios::app);
     if(!logfile_.is_open()) {
         throw std::runtime_error("Failed to open log file");
     }
+
+    if(options_.async) {
+        size_t capacity = 2;
+        while(capacity < options_.queue_capacity) {
+            capacity *= 2;
+        }
+        slots_ = std::make_unique<Slot[]>(capacity);
+        for(size_t i = 0; i < capacity; ++i) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        mask_ = capacity - 1;
+
+        running_ = true;
+        writer_ = std::thread(&Logger<T>::writerLoop, this);
+    }
 }
 
 template <typename T>
 Logger<T>::~Logger() {
+    shutdown();
     if(logfile_.is_open()) {
         logfile_.close();
     }
@@ -18,8 +45,137 @@ Logger<T>::~Logger() {
 
 template <typename T>
 void Logger<T>::log(const T& message) {
+    if(running_) {
+        while(!tryPush(message)) {
+            if(options_.overflow == LogOverflowPolicy::Drop || !running_) {
+                ++dropped_;
+                return;
+            }
+            wake_.notify_one();
+            std::this_thread::yield();
+        }
+        return;
+    }
+
     std::lock_guard<std::mutex> lock(mtx_);
     logfile_ << message << std::endl;
 }
 
+template <typename T>
+void Logger<T>::shutdown() {
+    if(!running_.exchange(false)) return;
+
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+    }
+    wake_.notify_one();
+    if(writer_.joinable()) {
+        writer_.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    drain();
+    logfile_.flush();
+}
+
+template <typename T>
+bool Logger<T>::tryPush(const T& message) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while(true) {
+        slot = &slots_[pos & mask_];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+        if(diff == 0) {
+            if(enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {
+            return false;
+        } else {
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->value = message;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+
+    // Pairs with the fence in writerLoop(): either the writer sees this
+    // entry before it goes idle, or this sees it idle and wakes it.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(idle_.load(std::memory_order_relaxed) && idle_.exchange(false)) {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+        }
+        wake_.notify_one();
+    } else if(pos - dequeue_pos_.load(std::memory_order_relaxed) >= mask_ / 2) {
+        wake_.notify_one();
+    }
+    return true;
+}
+
+// Entries are written straight from their slot rather than moved out, so
+// each slot keeps its buffer and steady-state logging does not allocate.
+template <typename T>
+size_t Logger<T>::drain() {
+    size_t count = 0;
+    while(true) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Slot& slot = slots_[pos & mask_];
+        if(slot.sequence.load(std::memory_order_acquire) != pos + 1) break;
+
+        logfile_ << slot.value << '\n';
+        slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+        dequeue_pos_.store(pos + 1, std::memory_order_relaxed);
+        ++count;
+    }
+    return count;
+}
+
+template <typename T>
+void Logger<T>::writerLoop() {
+    auto last_flush = std::chrono::steady_clock::now();
+    bool pending = false;
+
+    while(true) {
+        bool stopping = !running_;
+
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if(drain() > 0) {
+                pending = true;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if(pending && (stopping || now - last_flush >= options_.flush_interval)) {
+                logfile_.flush();
+                last_flush = now;
+                pending = false;
+            }
+        }
+
+        if(stopping) break;
+
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        if(pending) {
+            wake_.wait_for(lock, options_.flush_interval);
+            continue;
+        }
+
+        // Nothing to flush: sleep until the next entry rather than waking
+        // every flush interval.
+        idle_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        if(slots_[pos & mask_].sequence.load(std::memory_order_acquire) == pos + 1) {
+            idle_.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        wake_.wait(lock, [this] {
+            return !idle_.load(std::memory_order_relaxed) || !running_;
+        });
+        idle_.store(false, std::memory_order_relaxed);
+    }
+}
+
 template class Logger<std::string>;
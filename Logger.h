@@ -1,17 +1,66 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
 #include <fstream>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+
+enum class LogOverflowPolicy {
+    Drop,
+    Block
+};
+
+struct LoggerOptions {
+    bool async = false;
+    size_t queue_capacity = 8192;
+    std::chrono::milliseconds flush_interval{100};
+    size_t flush_bytes = 64 * 1024;
+    LogOverflowPolicy overflow = LogOverflowPolicy::Drop;
+};
 
 template <typename T>
 class Logger {
   public:
     Logger(const std::string& filename);
+    Logger(const std::string& filename, const LoggerOptions& options);
     ~Logger();
 
     void log(const T& message);
+    void shutdown();
+    size_t dropped() const {
+        return dropped_;
+    }
 
   private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    bool tryPush(const T& message);
+    size_t drain();
+    void writerLoop();
+
+    LoggerOptions options_;
+    std::vector<char> file_buffer_;
     std::ofstream logfile_;
     std::mutex mtx_;
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<size_t> dequeue_pos_{0};
+    std::atomic<bool> running_{false};
+    std::atomic<size_t> dropped_{0};
+    // Set while the writer sleeps with nothing to flush; the next log()
+    // has to wake it.
+    std::atomic<bool> idle_{false};
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::thread writer_;
 };
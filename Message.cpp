@@ -2,29 +2,38 @@
 #include <sstream>
 #include <vector>
 
-Message::Message(MessageType type, const std::string& sender,
-                 const std::string& content, const std::string& receiver)
-    : type_(type), sender_(sender), content_(content), receiver_(receiver) {}
+Message::Message(MessageType type, std::string_view sender,
+                 std::string_view content, std::string_view receiver)
+    : type_(type), sender_length_(static_cast<uint32_t>(sender.size())),
+      content_length_(static_cast<uint32_t>(content.size())) {
+    data_.reserve(sender.size() + content.size() + receiver.size());
+    data_.append(sender);
+    data_.append(content);
+    data_.append(receiver);
+}
+
+Message::Message(const MessageView& view)
+    : Message(view.getType(), view.getSender(), view.getContent(), view.getReceiver()) {}
 
 MessageType Message::getType() const {
     return type_;
 }
-std::string Message::getSender() const {
-    return sender_;
+std::string_view Message::getSender() const {
+    return std::string_view(data_).substr(0, sender_length_);
 }
-std::string Message::getContent() const {
-    return content_;
+std::string_view Message::getContent() const {
+    return std::string_view(data_).substr(sender_length_, content_length_);
 }
-std::string Message::getReceiver() const {
-    return receiver_;
+std::string_view Message::getReceiver() const {
+    return std::string_view(data_).substr(sender_length_ + content_length_);
 }
 
 std::string Message::serialize() const {
     std::ostringstream oss;
     oss << static_cast<int>(type_) << '|'
-        << sender_ << '|'
-        << content_ << '|'
-        << receiver_;
+        << getSender() << '|'
+        << getContent() << '|'
+        << getReceiver();
     return oss.str();
 }
 
@@ -48,9 +57,10 @@ Message Message::deserialize(const std::string& data) {
         return Message(MessageType::Broadcast, "ERROR", "Invalid message type");
     }
 
-    std::string sender = data.substr(pos1 + 1, pos2 - pos1 - 1);
-    std::string content = data.substr(pos2 + 1, (pos3 != std::string::npos) ? (pos3 - pos2 - 1) : (data.size() - pos2 - 1));
-    std::string receiver = (pos3 != std::string::npos) ? data.substr(pos3 + 1) : "";
+    std::string_view view(data);
+    std::string_view sender = view.substr(pos1 + 1, pos2 - pos1 - 1);
+    std::string_view content = view.substr(pos2 + 1, (pos3 != std::string::npos) ? (pos3 - pos2 - 1) : (data.size() - pos2 - 1));
+    std::string_view receiver = (pos3 != std::string::npos) ? view.substr(pos3 + 1) : std::string_view();
 
     return Message(static_cast<MessageType>(type), sender, content, receiver);
 }
@@ -1,23 +1,62 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include "MessageType.h"
 
+class Message;
+
+// Non-owning view of a message. Used on the dispatch path where the fields
+// point into the connection's receive buffer and live for one dispatch.
+class MessageView {
+  public:
+    MessageView(MessageType type, std::string_view sender,
+                std::string_view content, std::string_view receiver = {})
+        : type_(type), sender_(sender), content_(content), receiver_(receiver) {}
+    MessageView(const Message& msg);
+
+    MessageType getType() const {
+        return type_;
+    }
+    std::string_view getSender() const {
+        return sender_;
+    }
+    std::string_view getContent() const {
+        return content_;
+    }
+    std::string_view getReceiver() const {
+        return receiver_;
+    }
+
+  private:
+    MessageType type_;
+    std::string_view sender_;
+    std::string_view content_;
+    std::string_view receiver_;
+};
+
 class Message {
   public:
-    Message() : type_(MessageType::Broadcast), sender_(""), content_(""), receiver_("") {}
+    Message() : type_(MessageType::Broadcast), sender_length_(0), content_length_(0) {}
 
-    Message(MessageType type, const std::string& sender,
-            const std::string& content, const std::string& receiver = "");
+    Message(MessageType type, std::string_view sender,
+            std::string_view content, std::string_view receiver = {});
+    explicit Message(const MessageView& view);
     MessageType getType() const;
-    std::string getSender() const;
-    std::string getContent() const;
-    std::string getReceiver() const;
+    std::string_view getSender() const;
+    std::string_view getContent() const;
+    std::string_view getReceiver() const;
     std::string serialize() const;
     static Message deserialize(const std::string& data);
 
   private:
     MessageType type_;
-    std::string sender_;
-    std::string content_;
-    std::string receiver_;
+    // sender, content and receiver stored back to back in one buffer
+    std::string data_;
+    uint32_t sender_length_;
+    uint32_t content_length_;
 };
+
+inline MessageView::MessageView(const Message& msg)
+    : type_(msg.getType()), sender_(msg.getSender()),
+      content_(msg.getContent()), receiver_(msg.getReceiver()) {}
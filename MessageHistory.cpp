@@ -0,0 +1,55 @@
+#include "MessageHistory.h"
+#include <algorithm>
+
+MessageHistory::MessageHistory(size_t max_messages, size_t max_bytes)
+    : ring_(std::max<size_t>(1, max_messages)), max_bytes_(max_bytes) {}
+
+void MessageHistory::push(const Payload& text, const Payload& binary) {
+    size_t entry_bytes = text.size() + binary.size();
+    if(entry_bytes > max_bytes_) return;
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    while(count_ == ring_.size() || bytes_ + entry_bytes > max_bytes_) {
+        popOldest();
+    }
+    Entry& slot = ring_[(head_ + count_) % ring_.size()];
+    slot.text = text;
+    slot.binary = binary;
+    bytes_ += entry_bytes;
+    ++count_;
+}
+
+void MessageHistory::recent(size_t n, std::vector<Entry>& out) const {
+    out.clear();
+    std::lock_guard<std::mutex> lock(mtx_);
+    n = std::min(n, count_);
+    for(size_t i = count_ - n; i < count_; ++i) {
+        out.push_back(ring_[(head_ + i) % ring_.size()]);
+    }
+}
+
+void MessageHistory::clear() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    while(count_ > 0) {
+        popOldest();
+    }
+}
+
+size_t MessageHistory::size() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return count_;
+}
+
+size_t MessageHistory::bytes() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return bytes_;
+}
+
+void MessageHistory::popOldest() {
+    Entry& oldest = ring_[head_];
+    bytes_ -= oldest.text.size() + oldest.binary.size();
+    oldest.text = Payload();
+    oldest.binary = Payload();
+    head_ = (head_ + 1) % ring_.size();
+    --count_;
+}
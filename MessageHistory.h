@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include "Payload.h"
+
+// The most recent broadcasts, replayed to joining clients and by /history.
+// Entries hold the payloads already built for fan-out, so recording and
+// replaying a message only copies references. Slots are allocated up front;
+// the oldest entries are evicted to stay within both max_messages and
+// max_bytes.
+class MessageHistory {
+  public:
+    struct Entry {
+        Payload text;
+        Payload binary;
+    };
+
+    MessageHistory(size_t max_messages, size_t max_bytes);
+
+    void push(const Payload& text, const Payload& binary);
+    // Replaces out with up to n of the newest entries, oldest first.
+    void recent(size_t n, std::vector<Entry>& out) const;
+    void clear();
+
+    size_t size() const;
+    size_t bytes() const;
+    size_t capacity() const {
+        return ring_.size();
+    }
+
+  private:
+    void popOldest();
+
+    mutable std::mutex mtx_;
+    std::vector<Entry> ring_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t bytes_ = 0;
+    size_t max_bytes_;
+};
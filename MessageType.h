@@ -6,7 +6,11 @@ enum class MessageType {
     NickChange,
     Connect,
     Disconnect,
-    UsersList
+    UsersList,
+    System,
+    Join,
+    Part,
+    RoomMessage
 };
 
 namespace Colors {
@@ -0,0 +1,128 @@
+#include "Metrics.h"
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Metrics {
+
+namespace {
+
+struct alignas(64) ThreadMetrics {
+    std::array<std::atomic<uint64_t>, kCounters> counters{};
+    std::array<std::atomic<uint64_t>, kMessageTypes> messages{};
+    std::array<Histogram, kLatencies> latencies;
+};
+
+// Blocks outlive their threads so totals survive thread exit.
+struct Registry {
+    std::mutex mtx;
+    std::vector<std::unique_ptr<ThreadMetrics>> threads;
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+ThreadMetrics& local() {
+    thread_local ThreadMetrics* metrics = [] {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mtx);
+        reg.threads.push_back(std::make_unique<ThreadMetrics>());
+        return reg.threads.back().get();
+    }();
+    return *metrics;
+}
+
+// Only the owning thread writes, so a load and a store are enough.
+void bump(std::atomic<uint64_t>& value, uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+const char* messageTypeName(size_t type) {
+    static const char* const names[kMessageTypes] = {
+        "broadcast", "private", "nick", "connect", "disconnect",
+        "users", "system", "join", "part", "room"};
+    return names[type];
+}
+
+void appendLatency(std::string& out, const char* name, const Histogram& histogram) {
+    char line[160];
+    snprintf(line, sizeof(line), "%s us: p50 %.1f, p99 %.1f, p999 %.1f, max %.1f (n=%llu)\n", name,
+             histogram.percentile(50) / 1000.0, histogram.percentile(99) / 1000.0,
+             histogram.percentile(99.9) / 1000.0, histogram.max() / 1000.0,
+             static_cast<unsigned long long>(histogram.count()));
+    out += line;
+}
+
+}
+
+void add(Counter counter, uint64_t amount) {
+    bump(local().counters[static_cast<size_t>(counter)], amount);
+}
+
+void message(MessageType type) {
+    size_t index = static_cast<size_t>(type);
+    if(index < kMessageTypes) {
+        bump(local().messages[index], 1);
+    }
+}
+
+void record(Latency latency, uint64_t nanoseconds) {
+    local().latencies[static_cast<size_t>(latency)].record(nanoseconds);
+}
+
+void collect(Snapshot& snapshot) {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mtx);
+    for(const auto& thread : reg.threads) {
+        for(size_t i = 0; i < kCounters; ++i) {
+            snapshot.counters[i] += thread->counters[i].load(std::memory_order_relaxed);
+        }
+        for(size_t i = 0; i < kMessageTypes; ++i) {
+            snapshot.messages[i] += thread->messages[i].load(std::memory_order_relaxed);
+        }
+        for(size_t i = 0; i < kLatencies; ++i) {
+            snapshot.latencies[i].merge(thread->latencies[i]);
+        }
+    }
+}
+
+std::string format(const Snapshot& snapshot) {
+    auto value = [&](Counter counter) {
+        return std::to_string(snapshot.get(counter));
+    };
+
+    uint64_t queued = snapshot.get(Counter::BytesQueued);
+    uint64_t drained = snapshot.get(Counter::BytesOut) + snapshot.get(Counter::BytesDiscarded);
+
+    std::string out;
+    out += "connections: " + std::to_string(snapshot.get(Counter::Accepts) - snapshot.get(Counter::Disconnects)) +
+           " open (" + value(Counter::Accepts) + " accepted, " + value(Counter::Disconnects) + " closed)\n";
+    out += "bytes: " + value(Counter::BytesIn) + " in, " + value(Counter::BytesOut) + " out, " +
+           std::to_string(queued > drained ? queued - drained : 0) + " queued\n";
+    out += "backpressure: " + value(Counter::Congestions) + " congested, " + value(Counter::EvictedSends) +
+           " evicted, " + value(Counter::ShedSends) + " shed, " + value(Counter::DroppedSends) + " dropped, " +
+           value(Counter::SlowDisconnects) + " disconnected\n";
+    out += "flood control: " + value(Counter::FloodThrottles) + " throttled, " + value(Counter::FloodDrops) +
+           " dropped, " + value(Counter::FloodDisconnects) + " disconnected\n";
+    out += "timeouts: " + value(Counter::IdleDisconnects) + " idle, " + value(Counter::KeepalivePings) +
+           " keepalives, " + value(Counter::LingerTimeouts) + " lingered\n";
+
+    out += "messages:";
+    for(size_t i = 0; i < kMessageTypes; ++i) {
+        if(snapshot.messages[i] == 0) continue;
+        out += " ";
+        out += messageTypeName(i);
+        out += "=" + std::to_string(snapshot.messages[i]);
+    }
+    out += "\n";
+
+    appendLatency(out, "dispatch", snapshot.latencies[static_cast<size_t>(Latency::Dispatch)]);
+    appendLatency(out, "send", snapshot.latencies[static_cast<size_t>(Latency::Send)]);
+    return out;
+}
+
+}
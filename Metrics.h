@@ -0,0 +1,78 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "Histogram.h"
+#include "MessageType.h"
+
+// Process-wide server metrics. Each thread writes only to its own block of
+// counters and histograms (registered on first use), so recording is a
+// plain relaxed store with no shared cache lines or locks; collect() sums
+// every thread's block on demand.
+namespace Metrics {
+
+enum class Counter : size_t {
+    Accepts,
+    Disconnects,
+    BytesIn,
+    BytesOut,
+    BytesQueued,
+    BytesDiscarded,
+    DroppedSends,
+    // Backpressure: clients going over their high-water mark, and what the
+    // policies discarded (drop-oldest, drop-non-system, disconnect).
+    Congestions,
+    EvictedSends,
+    ShedSends,
+    SlowDisconnects,
+    // Flood control: clients throttled (once per wait), messages dropped,
+    // clients disconnected.
+    FloodThrottles,
+    FloodDrops,
+    FloodDisconnects,
+    // Timers: clients closed for inactivity, keepalives sent, leaving
+    // clients closed before they read everything queued for them.
+    IdleDisconnects,
+    KeepalivePings,
+    LingerTimeouts,
+    Count
+};
+
+enum class Latency : size_t {
+    Dispatch,
+    Send,
+    Count
+};
+
+constexpr size_t kCounters = static_cast<size_t>(Counter::Count);
+constexpr size_t kLatencies = static_cast<size_t>(Latency::Count);
+constexpr size_t kMessageTypes = static_cast<size_t>(MessageType::RoomMessage) + 1;
+
+inline uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void add(Counter counter, uint64_t amount = 1);
+void message(MessageType type);
+void record(Latency latency, uint64_t nanoseconds);
+
+struct Snapshot {
+    std::array<uint64_t, kCounters> counters{};
+    std::array<uint64_t, kMessageTypes> messages{};
+    std::array<Histogram, kLatencies> latencies;
+
+    uint64_t get(Counter counter) const {
+        return counters[static_cast<size_t>(counter)];
+    }
+};
+
+void collect(Snapshot& snapshot);
+
+// Multi-line plain-text report of a snapshot.
+std::string format(const Snapshot& snapshot);
+
+}
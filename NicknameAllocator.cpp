@@ -0,0 +1,83 @@
+#include "NicknameAllocator.h"
+
+static constexpr std::string_view kPrefix = "User";
+
+NicknameAllocator::NicknameAllocator() {
+    reset();
+}
+
+bool NicknameAllocator::parse(std::string_view nickname, uint32_t& number) {
+    if(nickname.size() <= kPrefix.size() || nickname.substr(0, kPrefix.size()) != kPrefix) {
+        return false;
+    }
+
+    std::string_view digits = nickname.substr(kPrefix.size());
+    if(digits.size() > 9 || digits.front() == '0') return false;
+
+    uint32_t value = 0;
+    for(char c : digits) {
+        if(c < '0' || c > '9') return false;
+        value = value * 10 + static_cast<uint32_t>(c - '0');
+    }
+    number = value;
+    return true;
+}
+
+std::string NicknameAllocator::acquire() {
+    uint32_t number;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        while(true) {
+            if(!free_.empty()) {
+                number = free_.top();
+                free_.pop();
+                if(used_[number]) continue;
+                used_[number] = true;
+                break;
+            }
+
+            while(!ahead_.empty() && *ahead_.begin() == next_) {
+                ahead_.erase(ahead_.begin());
+                used_.push_back(true);
+                ++next_;
+            }
+            number = next_++;
+            used_.push_back(true);
+            break;
+        }
+    }
+    return std::string(kPrefix) + std::to_string(number);
+}
+
+void NicknameAllocator::claim(std::string_view nickname) {
+    uint32_t number;
+    if(!parse(nickname, number)) return;
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if(number < next_) {
+        used_[number] = true;
+    } else {
+        ahead_.insert(number);
+    }
+}
+
+void NicknameAllocator::release(std::string_view nickname) {
+    uint32_t number;
+    if(!parse(nickname, number)) return;
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if(number >= next_) {
+        ahead_.erase(number);
+    } else if(used_[number]) {
+        used_[number] = false;
+        free_.push(number);
+    }
+}
+
+void NicknameAllocator::reset() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    used_.assign(1, true);
+    ahead_.clear();
+    free_ = decltype(free_)();
+    next_ = 1;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Hands out the lowest free default nickname "UserN" without looking at the
+// nickname registry. The server reports every "UserN" name that becomes
+// taken (accept, /nick) or free again (/nick away, disconnect); acquire()
+// is O(log N) amortized.
+class NicknameAllocator {
+  public:
+    NicknameAllocator();
+
+    std::string acquire();
+    void claim(std::string_view nickname);
+    void release(std::string_view nickname);
+    void reset();
+
+    // True if nickname is a canonical "UserN" name (N > 0, no leading zeros).
+    static bool parse(std::string_view nickname, uint32_t& number);
+
+  private:
+    std::mutex mtx_;
+    // used_[n] for every n below next_; numbers at or above next_ that were
+    // claimed through /nick wait in ahead_ until next_ reaches them.
+    std::vector<bool> used_;
+    std::set<uint32_t> ahead_;
+    // Freed numbers below next_. Entries claimed again since they were
+    // pushed are stale and skipped when popped.
+    std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> free_;
+    uint32_t next_ = 1;
+};
@@ -0,0 +1,94 @@
+#include "OutboundQueue.h"
+
+static constexpr size_t kInitialSlots = 32;
+
+// Every client's first ring is the same size, so those are recycled between
+// connections; rings that had to grow come from the heap. A new client's
+// banner and history replay fit in the first one.
+static BlockPool& ringPool() {
+    static BlockPool pool("outbound queues", kInitialSlots * sizeof(Payload), 1024);
+    return pool;
+}
+
+OutboundQueue::OutboundQueue() : ring_(PoolAllocator<Payload>(ringPool())) {}
+
+void OutboundQueue::push(Payload payload) {
+    if(payload.empty()) return;
+    if(count_ == ring_.size()) {
+        grow();
+    }
+    bytes_ += payload.size();
+    ring_[(head_ + count_) & (ring_.size() - 1)] = std::move(payload);
+    ++count_;
+}
+
+int OutboundQueue::fillIov(iovec* iov, int max_iov) const {
+    int filled = 0;
+    size_t offset = offset_;
+    for(size_t i = 0; i < count_ && filled < max_iov; ++i) {
+        const Payload& payload = ring_[(head_ + i) & (ring_.size() - 1)];
+        iov[filled].iov_base = const_cast<char*>(payload.data()) + offset;
+        iov[filled].iov_len = payload.size() - offset;
+        offset = 0;
+        ++filled;
+    }
+    return filled;
+}
+
+void OutboundQueue::consume(size_t bytes) {
+    bytes_ -= bytes;
+    while(bytes > 0 && count_ > 0) {
+        Payload& front = ring_[head_];
+        size_t front_left = front.size() - offset_;
+        if(bytes < front_left) {
+            offset_ += bytes;
+            return;
+        }
+        bytes -= front_left;
+        offset_ = 0;
+        front = Payload();
+        head_ = (head_ + 1) & (ring_.size() - 1);
+        --count_;
+    }
+}
+
+void OutboundQueue::clear() {
+    while(count_ > 0) {
+        ring_[head_] = Payload();
+        head_ = (head_ + 1) & (ring_.size() - 1);
+        --count_;
+    }
+    head_ = 0;
+    offset_ = 0;
+    bytes_ = 0;
+}
+
+size_t OutboundQueue::dropOldest(size_t max_bytes) {
+    const size_t mask = ring_.size() - 1;
+    // Cutting a payload that is partly on the wire would corrupt the stream,
+    // so it moves into the slot of the one dropped after it.
+    const size_t keep = offset_ > 0 ? 1 : 0;
+    size_t dropped = 0;
+    while(bytes_ > max_bytes && count_ > keep) {
+        Payload& victim = ring_[(head_ + keep) & mask];
+        bytes_ -= victim.size();
+        if(keep) {
+            victim = std::move(ring_[head_]);
+        } else {
+            victim = Payload();
+        }
+        head_ = (head_ + 1) & mask;
+        --count_;
+        ++dropped;
+    }
+    return dropped;
+}
+
+void OutboundQueue::grow() {
+    Ring grown(ring_.empty() ? kInitialSlots : ring_.size() * 2, ring_.get_allocator());
+    for(size_t i = 0; i < count_; ++i) {
+        grown[i] = std::move(ring_[(head_ + i) & (ring_.size() - 1)]);
+    }
+    ring_.swap(grown);
+    head_ = 0;
+}
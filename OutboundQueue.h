@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <sys/uio.h>
+#include "BlockPool.h"
+#include "Payload.h"
+
+class OutboundQueue {
+  public:
+    OutboundQueue();
+
+    void push(Payload payload);
+    int fillIov(iovec* iov, int max_iov) const;
+    void consume(size_t bytes);
+    void clear();
+    // Discards whole payloads from the front until at most max_bytes remain,
+    // keeping a partly written one; returns how many were dropped.
+    size_t dropOldest(size_t max_bytes);
+
+    bool empty() const {
+        return count_ == 0;
+    }
+    size_t size() const {
+        return count_;
+    }
+    size_t bytes() const {
+        return bytes_;
+    }
+
+  private:
+    using Ring = std::vector<Payload, PoolAllocator<Payload>>;
+
+    void grow();
+
+    Ring ring_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t offset_ = 0;
+    size_t bytes_ = 0;
+};
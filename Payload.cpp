@@ -0,0 +1,114 @@
+#include "Payload.h"
+#include <mutex>
+#include <vector>
+
+static constexpr size_t kMaxPooledBuffers = 4096;
+static constexpr size_t kMaxPooledCapacity = 64 * 1024;
+
+class PayloadPool {
+  public:
+    PayloadPool() {
+        free.reserve(kMaxPooledBuffers);
+    }
+    ~PayloadPool() {
+        for(auto* buffer : free) {
+            delete buffer;
+        }
+    }
+
+    std::mutex mtx;
+    std::vector<Payload::Buffer*> free;
+    std::atomic<size_t> in_use{0};
+};
+
+static PayloadPool& pool() {
+    static PayloadPool instance;
+    return instance;
+}
+
+Payload::Payload(const Payload& other) : buffer_(other.buffer_) {
+    if(buffer_) {
+        buffer_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Payload::Payload(Payload&& other) noexcept : buffer_(other.buffer_) {
+    other.buffer_ = nullptr;
+}
+
+Payload& Payload::operator=(const Payload& other) {
+    if(this != &other) {
+        Payload copy(other);
+        std::swap(buffer_, copy.buffer_);
+    }
+    return *this;
+}
+
+Payload& Payload::operator=(Payload&& other) noexcept {
+    if(this != &other) {
+        if(buffer_) release(buffer_);
+        buffer_ = other.buffer_;
+        other.buffer_ = nullptr;
+    }
+    return *this;
+}
+
+Payload::~Payload() {
+    if(buffer_) release(buffer_);
+}
+
+Payload Payload::line(std::string_view text) {
+    return build([&](std::string& bytes) {
+        bytes.reserve(text.size() + 2);
+        bytes += '\r';
+        bytes.append(text);
+        bytes += '\n';
+    });
+}
+
+Payload Payload::raw(std::string_view data) {
+    return build([&](std::string& bytes) {
+        bytes.assign(data);
+    });
+}
+
+size_t Payload::buffersInUse() {
+    return pool().in_use.load(std::memory_order_relaxed);
+}
+
+size_t Payload::buffersFree() {
+    PayloadPool& buffers = pool();
+    std::lock_guard<std::mutex> lock(buffers.mtx);
+    return buffers.free.size();
+}
+
+Payload::Buffer* Payload::acquire() {
+    PayloadPool& buffers = pool();
+    buffers.in_use.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(buffers.mtx);
+        if(!buffers.free.empty()) {
+            Buffer* buffer = buffers.free.back();
+            buffers.free.pop_back();
+            buffer->refs.store(1, std::memory_order_relaxed);
+            return buffer;
+        }
+    }
+    return new Buffer();
+}
+
+void Payload::release(Buffer* buffer) {
+    if(buffer->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+    PayloadPool& buffers = pool();
+    buffers.in_use.fetch_sub(1, std::memory_order_relaxed);
+    if(buffer->bytes.capacity() <= kMaxPooledCapacity) {
+        buffer->bytes.clear();
+        std::lock_guard<std::mutex> lock(buffers.mtx);
+        if(buffers.free.size() < kMaxPooledBuffers) {
+            buffers.free.push_back(buffer);
+            return;
+        }
+    }
+    delete buffer;
+}
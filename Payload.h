@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+class Payload {
+  public:
+    Payload() = default;
+    Payload(const Payload& other);
+    Payload(Payload&& other) noexcept;
+    Payload& operator=(const Payload& other);
+    Payload& operator=(Payload&& other) noexcept;
+    ~Payload();
+
+    // Fills a recycled buffer through fill(std::string&) and freezes it.
+    template <typename Fill>
+    static Payload build(Fill&& fill);
+
+    static Payload line(std::string_view text);
+    static Payload raw(std::string_view bytes);
+
+    const char* data() const {
+        return buffer_ ? buffer_->bytes.data() : nullptr;
+    }
+    size_t size() const {
+        return buffer_ ? buffer_->bytes.size() : 0;
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // Buffers currently referenced by a Payload, and released ones kept
+    // for reuse.
+    static size_t buffersInUse();
+    static size_t buffersFree();
+
+  private:
+    friend class PayloadPool;
+
+    struct Buffer {
+        std::atomic<size_t> refs{1};
+        std::string bytes;
+    };
+
+    explicit Payload(Buffer* buffer) : buffer_(buffer) {}
+
+    static Buffer* acquire();
+    static void release(Buffer* buffer);
+
+    Buffer* buffer_ = nullptr;
+};
+
+template <typename Fill>
+Payload Payload::build(Fill&& fill) {
+    Buffer* buffer = acquire();
+    try {
+        fill(buffer->bytes);
+    } catch(...) {
+        release(buffer);
+        throw;
+    }
+    return Payload(buffer);
+}
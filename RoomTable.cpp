@@ -0,0 +1,84 @@
+#include "RoomTable.h"
+#include <algorithm>
+#include <cctype>
+
+bool RoomTable::normalize(std::string_view requested, std::string& name) {
+    size_t start = requested.find_first_not_of(" \t\r\n");
+    size_t end = requested.find_last_not_of(" \t\r\n");
+    if(start == std::string_view::npos) return false;
+
+    requested = requested.substr(start, end - start + 1);
+    if(!requested.empty() && requested.front() == '#') {
+        requested.remove_prefix(1);
+    }
+    if(requested.empty() || requested.size() > kMaxNameLength) return false;
+
+    for(char c : requested) {
+        if(!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') {
+            return false;
+        }
+    }
+    name.assign(requested);
+    return true;
+}
+
+size_t RoomTable::join(const std::string& room, const ClientPtr& client) {
+    std::unique_lock<std::shared_mutex> lock(mtx_);
+    auto& slot = rooms_[room];
+    if(!slot) {
+        slot = std::make_shared<Room>();
+    }
+
+    std::unique_lock<std::shared_mutex> room_lock(slot->mtx);
+    auto& members = slot->members;
+    if(std::find(members.begin(), members.end(), client) != members.end()) {
+        return 0;
+    }
+    members.push_back(client);
+    return members.size();
+}
+
+bool RoomTable::part(const std::string& room, const ClientHandler* client) {
+    std::unique_lock<std::shared_mutex> lock(mtx_);
+    auto it = rooms_.find(room);
+    if(it == rooms_.end()) return false;
+
+    bool empty;
+    {
+        std::unique_lock<std::shared_mutex> room_lock(it->second->mtx);
+        auto& members = it->second->members;
+        auto member = std::find_if(members.begin(), members.end(), [client](const ClientPtr& m) {
+            return m.get() == client;
+        });
+        if(member == members.end()) return false;
+
+        *member = std::move(members.back());
+        members.pop_back();
+        empty = members.empty();
+    }
+
+    if(empty) {
+        rooms_.erase(it);
+    }
+    return true;
+}
+
+std::shared_ptr<const RoomTable::Room> RoomTable::find(const std::string& room) const {
+    std::shared_lock<std::shared_mutex> lock(mtx_);
+    auto it = rooms_.find(room);
+    return it == rooms_.end() ? nullptr : it->second;
+}
+
+std::vector<std::pair<std::string, size_t>> RoomTable::list() const {
+    std::vector<std::pair<std::string, size_t>> rooms;
+    {
+        std::shared_lock<std::shared_mutex> lock(mtx_);
+        rooms.reserve(rooms_.size());
+        for(const auto& [name, room] : rooms_) {
+            std::shared_lock<std::shared_mutex> room_lock(room->mtx);
+            rooms.emplace_back(name, room->members.size());
+        }
+    }
+    std::sort(rooms.begin(), rooms.end());
+    return rooms;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class ClientHandler;
+
+// Named rooms and their members. Each room keeps its members in one
+// contiguous array, so a room message costs one pass over that room's
+// members no matter how many clients are connected. Rooms are created by
+// the first join and dropped when the last member leaves.
+class RoomTable {
+  public:
+    using ClientPtr = std::shared_ptr<ClientHandler>;
+
+    static constexpr size_t kMaxNameLength = 20;
+
+    // Accepts "name" or "#name"; false if it is not a valid room name.
+    static bool normalize(std::string_view requested, std::string& name);
+
+    // Returns the member count after joining, or 0 if already a member.
+    size_t join(const std::string& room, const ClientPtr& client);
+    // Returns false if client was not in the room.
+    bool part(const std::string& room, const ClientHandler* client);
+
+    // Calls fn(ClientHandler&) for every member and returns the member count.
+    template <typename Fn>
+    size_t forEachMember(const std::string& room, Fn&& fn) const;
+
+    // (name, member count) pairs sorted by name.
+    std::vector<std::pair<std::string, size_t>> list() const;
+
+  private:
+    struct Room {
+        mutable std::shared_mutex mtx;
+        std::vector<ClientPtr> members;
+    };
+
+    std::shared_ptr<const Room> find(const std::string& room) const;
+
+    mutable std::shared_mutex mtx_;
+    std::unordered_map<std::string, std::shared_ptr<Room>> rooms_;
+};
+
+template <typename Fn>
+size_t RoomTable::forEachMember(const std::string& room, Fn&& fn) const {
+    auto found = find(room);
+    if(!found) return 0;
+
+    std::shared_lock<std::shared_mutex> lock(found->mtx);
+    for(const auto& member : found->members) {
+        fn(*member);
+    }
+    return found->members.size();
+}
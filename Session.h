@@ -0,0 +1,78 @@
+#pragma once
+#include <coroutine>
+#include <cstddef>
+#include <utility>
+#include "BlockPool.h"
+
+// A client's protocol logic written as a coroutine. It runs on the shard's
+// thread from the call until its first co_await that cannot complete, and
+// is resumed there by its ClientHandler when input arrives or its queue
+// drains, so a session costs one heap frame instead of a thread and stack.
+// Destroying the Session destroys the frame wherever it is suspended.
+class Session {
+  public:
+    struct promise_type {
+        // Frames come from a pool shared by every session; one too large
+        // for its blocks goes to the heap.
+        static void* operator new(size_t size) {
+            return framePool().allocate(size);
+        }
+        static void operator delete(void* frame, size_t size) noexcept {
+            framePool().deallocate(frame, size);
+        }
+
+        Session get_return_object() {
+            return Session(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_always final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        // Hands the exception to whoever resumed the session.
+        void unhandled_exception() {
+            throw;
+        }
+    };
+
+    Session() = default;
+    Session(Session&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    Session& operator=(Session&& other) noexcept {
+        if(this != &other) {
+            reset();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+    ~Session() {
+        reset();
+    }
+
+    bool started() const {
+        return static_cast<bool>(handle_);
+    }
+    bool done() const {
+        return handle_ && handle_.done();
+    }
+
+  private:
+    explicit Session(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    static BlockPool& framePool() {
+        static BlockPool pool("session frames", 256, 1024);
+        return pool;
+    }
+
+    void reset() {
+        if(handle_) {
+            handle_.destroy();
+            handle_ = nullptr;
+        }
+    }
+
+    std::coroutine_handle<promise_type> handle_;
+};
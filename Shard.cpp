@@ -0,0 +1,270 @@
+#include "Shard.h"
+#include "ChatServer.h"
+#include "ClientHandler.h"
+#include "Log.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static thread_local Shard* current_shard = nullptr;
+
+Shard::Shard(ChatServer* server, size_t index, IoBackendKind io)
+    : server_(server), index_(index), io_(IoBackend::create(io)), timers_(Metrics::nowNs()) {
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wake_fd_ < 0) {
+        throw std::runtime_error("eventfd failed: " + std::string(strerror(errno)));
+    }
+    io_->watch(wake_fd_, [this]() {
+        uint64_t value;
+        while(read(wake_fd_, &value, sizeof(value)) > 0) {
+        }
+    });
+}
+
+Shard::~Shard() {
+    stop();
+    join();
+    io_->clear();
+    clients_.clear();
+    timers_.clear();
+    if(listen_socket_ != -1) {
+        close(listen_socket_);
+    }
+    close(wake_fd_);
+}
+
+void Shard::listen(int port) {
+    listen_socket_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listen_socket_ < 0) {
+        throw std::runtime_error("Socket creation failed");
+    }
+
+    // Every shard binds the same port; the kernel spreads incoming
+    // connections across the listening sockets.
+    int opt = 1;
+    if(setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+       setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        throw std::runtime_error("setsockopt failed");
+    }
+
+    sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    if(bind(listen_socket_, (sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        throw std::runtime_error("Bind failed");
+    }
+    if(::listen(listen_socket_, SOMAXCONN) < 0) {
+        throw std::runtime_error("Listen failed");
+    }
+
+    io_->listen(listen_socket_, [this](int socket) {
+        server_->acceptClient(*this, socket);
+    });
+}
+
+void Shard::start() {
+    thread_ = std::thread(&Shard::run, this);
+}
+
+void Shard::stop() {
+    stopping_ = true;
+    wake();
+}
+
+void Shard::join() {
+    if(thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void Shard::run() {
+    current_shard = this;
+
+    // Once stopped, keep going until the clients have said goodbye or the
+    // shutdown grace period is up.
+    uint64_t shutdown_deadline = 0;
+    while(true) {
+        if(stopping_) {
+            const uint64_t now = Metrics::nowNs();
+            if(shutdown_deadline == 0) {
+                shutdown_deadline = now + std::chrono::nanoseconds(server_->timeouts().shutdown).count();
+                // Only there to wake the loop at the deadline.
+                timers_.schedule(shutdown_deadline, [] {});
+            }
+            if(clients_.empty() || now >= shutdown_deadline) break;
+        }
+
+        try {
+            io_->poll(pollTimeout());
+        } catch(const std::exception& e) {
+            Log::error("[Shard ", index_, "] ", e.what());
+        }
+        timers_.advance(Metrics::nowNs());
+        drain();
+    }
+
+    drain();
+    io_->clear();
+    clients_.clear();
+    timers_.clear();
+    size_ = 0;
+    current_shard = nullptr;
+}
+
+// current_shard is set by run() on the shard's own thread, so before
+// start() and after join() every other thread still goes through post().
+bool Shard::isLocal() const {
+    return current_shard == this || inline_;
+}
+
+void Shard::wake() {
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd_, &one, sizeof(one));
+    (void)written;
+}
+
+void Shard::attach(std::shared_ptr<ClientHandler> client) {
+    io_->add(client->getSocket(), client);
+
+    client->last_input_ns_ = Metrics::nowNs();
+    client->watchIdle();
+    client->shard_slot_ = clients_.size();
+    clients_.push_back(std::move(client));
+    ++size_;
+}
+
+void Shard::post(const Payload& text, const Payload& binary, ClientHandler* exclude, Traffic traffic) {
+    if(isLocal()) {
+        deliver(text, binary, exclude, traffic);
+        return;
+    }
+
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        was_empty = inbox_.empty();
+        inbox_.push_back({text, binary, exclude, traffic});
+    }
+    if(was_empty) {
+        wake();
+    }
+}
+
+void Shard::deliver(const Payload& text, const Payload& binary, ClientHandler* exclude, Traffic traffic) {
+    for(auto& client : clients_) {
+        if(client.get() == exclude) continue;
+        client->sendMessage(client->isBinary() ? binary : text, traffic);
+    }
+}
+
+bool Shard::deliverPosted() {
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        delivering_.swap(inbox_);
+    }
+    if(delivering_.empty()) return false;
+
+    for(auto& delivery : delivering_) {
+        deliver(delivery.text, delivery.binary, delivery.exclude, delivery.traffic);
+    }
+    delivering_.clear();
+    return true;
+}
+
+void Shard::scheduleFlush(std::shared_ptr<ClientHandler> client) {
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> lock(flush_mutex_);
+        was_empty = pending_flushes_.empty();
+        pending_flushes_.push_back(std::move(client));
+    }
+    if(was_empty && !isLocal()) {
+        wake();
+    }
+}
+
+void Shard::flushPending() {
+    while(true) {
+        {
+            std::lock_guard<std::mutex> lock(flush_mutex_);
+            flushing_.swap(pending_flushes_);
+        }
+        if(flushing_.empty()) break;
+
+        for(auto& client : flushing_) {
+            client->flush();
+        }
+        flushing_.clear();
+    }
+}
+
+void Shard::scheduleRemoval(ClientHandler* client) {
+    {
+        std::lock_guard<std::mutex> lock(removal_mutex_);
+        if(std::find(clients_to_remove_.begin(), clients_to_remove_.end(), client) != clients_to_remove_.end()) {
+            return;
+        }
+        clients_to_remove_.push_back(client);
+    }
+    // A dispatch worker hands over the clients it held back.
+    if(!isLocal()) {
+        wake();
+    }
+}
+
+bool Shard::processRemovals() {
+    {
+        std::lock_guard<std::mutex> lock(removal_mutex_);
+        removing_.swap(clients_to_remove_);
+    }
+    if(removing_.empty()) return false;
+
+    for(auto* client : removing_) {
+        size_t slot = client->shard_slot_;
+        if(slot >= clients_.size() || clients_[slot].get() != client) continue;
+
+        std::shared_ptr<ClientHandler> owned = std::move(clients_[slot]);
+        if(slot + 1 != clients_.size()) {
+            clients_[slot] = std::move(clients_.back());
+            clients_[slot]->shard_slot_ = slot;
+        }
+        clients_.pop_back();
+        --size_;
+
+        io_->remove(client->getSocket());
+        server_->clientDisconnected(client);
+        // Nothing writes to a removed client, so its backlog stops counting now.
+        owned->discardOutbound();
+    }
+    removing_.clear();
+    return true;
+}
+
+void Shard::schedule(uint64_t deadline_ns, std::function<void()> callback) {
+    timers_.schedule(deadline_ns, std::move(callback));
+}
+
+// Blocks until the next timer is due, or indefinitely when none is pending:
+// an idle shard does not wake up at all.
+int Shard::pollTimeout() const {
+    return timers_.timeoutMs(Metrics::nowNs());
+}
+
+void Shard::drain() {
+    do {
+        deliverPosted();
+        flushPending();
+    } while(processRemovals());
+}
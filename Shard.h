@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Backpressure.h"
+#include "IoBackend.h"
+#include "Payload.h"
+#include "TimerWheel.h"
+
+class ChatServer;
+class ClientHandler;
+
+// One reactor thread. A shard owns an I/O backend, its own SO_REUSEPORT
+// listening socket and every client the kernel hands to that socket; all
+// socket I/O for those clients happens on the shard's thread. Other threads
+// reach a shard only through post() and scheduleFlush(), which wake the loop
+// through an eventfd.
+class Shard {
+  public:
+    Shard(ChatServer* server, size_t index, IoBackendKind io = IoBackendKind::Epoll);
+    ~Shard();
+
+    void listen(int port);
+    void start();
+    // Instead of start(): no thread runs the shard, whoever calls it drives
+    // it through drain() (chat_bench).
+    void runInline() {
+        inline_ = true;
+    }
+    void stop();
+    void join();
+
+    void attach(std::shared_ptr<ClientHandler> client);
+    void scheduleFlush(std::shared_ptr<ClientHandler> client);
+    void scheduleRemoval(ClientHandler* client);
+    // A write to the client's socket hit EAGAIN.
+    void waitWritable(int socket) {
+        io_->waitWritable(socket);
+    }
+
+    // Hands a broadcast to this shard's clients, delivering in place when
+    // the caller already runs on the shard.
+    void post(const Payload& text, const Payload& binary, ClientHandler* exclude, Traffic traffic);
+
+    // Runs queued deliveries, flushes and removals until none are left.
+    void drain();
+
+    // Runs callback on the shard's thread once Metrics::nowNs() reaches
+    // deadline_ns. Only code already running on the shard may schedule.
+    void schedule(uint64_t deadline_ns, std::function<void()> callback);
+
+    size_t index() const {
+        return index_;
+    }
+    size_t size() const {
+        return size_;
+    }
+    int listenSocket() const {
+        return listen_socket_;
+    }
+    const char* ioBackend() const {
+        return io_->name();
+    }
+
+    // Outbound bytes queued for this shard's clients, kept by the clients
+    // themselves so the server can enforce its memory budget.
+    void addQueued(size_t bytes) {
+        queued_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    void removeQueued(size_t bytes) {
+        queued_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+    size_t queuedBytes() const {
+        return queued_bytes_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct Delivery {
+        Payload text;
+        Payload binary;
+        ClientHandler* exclude;
+        Traffic traffic;
+    };
+
+    bool isLocal() const;
+    void wake();
+    void run();
+    int pollTimeout() const;
+    void deliver(const Payload& text, const Payload& binary, ClientHandler* exclude, Traffic traffic);
+    bool deliverPosted();
+    void flushPending();
+    bool processRemovals();
+
+    ChatServer* server_;
+    size_t index_;
+    int listen_socket_ = -1;
+    int wake_fd_ = -1;
+    std::atomic<bool> stopping_{false};
+    // Set before use and never changed, so other threads may read it.
+    bool inline_ = false;
+    std::thread thread_;
+    std::unique_ptr<IoBackend> io_;
+
+    alignas(64) std::atomic<size_t> queued_bytes_{0};
+    std::vector<std::shared_ptr<ClientHandler>> clients_;
+    std::atomic<size_t> size_{0};
+
+    std::mutex inbox_mutex_;
+    std::vector<Delivery> inbox_;
+    std::vector<Delivery> delivering_;
+
+    std::mutex flush_mutex_;
+    std::vector<std::shared_ptr<ClientHandler>> pending_flushes_;
+    std::vector<std::shared_ptr<ClientHandler>> flushing_;
+
+    // Touched only by the shard's thread.
+    TimerWheel timers_;
+
+    std::mutex removal_mutex_;
+    std::vector<ClientHandler*> clients_to_remove_;
+    std::vector<ClientHandler*> removing_;
+};
@@ -0,0 +1,17 @@
+#pragma once
+#include <chrono>
+
+// Connection deadlines, all kept on the shards' timer wheels. Zero turns a
+// timer off.
+struct TimeoutConfig {
+    // Close a connection that has sent nothing for this long.
+    std::chrono::seconds idle{30 * 60};
+    // Write a keepalive to a connection that has been quiet for this long,
+    // so dead peers are noticed before the idle timeout.
+    std::chrono::seconds keepalive{5 * 60};
+    // How long a leaving client gets to read its last messages before its
+    // socket is closed anyway.
+    std::chrono::milliseconds linger{2000};
+    // How long stop() lets the shards drain their clients.
+    std::chrono::milliseconds shutdown{3000};
+};
@@ -0,0 +1,114 @@
+#include "TimerWheel.h"
+#include "Log.h"
+#include <algorithm>
+#include <exception>
+
+// Further out than the top level can tell apart; such deadlines are pulled
+// in to this, and their callbacks find out they are early.
+static constexpr uint64_t kMaxTicks = (uint64_t{1} << 32) - (uint64_t{1} << 24);
+
+TimerWheel::TimerWheel(uint64_t now_ns) : current_(now_ns / kTickNs) {}
+
+void TimerWheel::schedule(uint64_t deadline_ns, Callback callback) {
+    // Rounded up, so a timer never fires before its deadline.
+    uint64_t tick = (deadline_ns + kTickNs - 1) / kTickNs;
+    tick = std::clamp(tick, current_ + 1, current_ + kMaxTicks);
+    place({tick, std::move(callback)});
+    ++size_;
+}
+
+// A timer goes on the lowest level whose current revolution still
+// includes its tick; only level 0 slots are exact.
+void TimerWheel::place(Timer timer) {
+    size_t level = 0;
+    while(level + 1 < kLevels &&
+          (timer.tick >> (kSlotBits * (level + 1))) != (current_ >> (kSlotBits * (level + 1)))) {
+        ++level;
+    }
+    size_t slot = (timer.tick >> (kSlotBits * level)) & kSlotMask;
+    slots_[level][slot].push_back(std::move(timer));
+    ++level_sizes_[level];
+}
+
+void TimerWheel::cascade(size_t level) {
+    std::vector<Timer>& slot = slots_[level][(current_ >> (kSlotBits * level)) & kSlotMask];
+    if(slot.empty()) return;
+
+    spare_.swap(slot);
+    level_sizes_[level] -= spare_.size();
+    for(auto& timer : spare_) {
+        place(std::move(timer));
+    }
+    spare_.clear();
+}
+
+void TimerWheel::advance(uint64_t now_ns) {
+    const uint64_t target = now_ns / kTickNs;
+
+    while(current_ < target) {
+        if(size_ == 0) {
+            current_ = target;
+            break;
+        }
+
+        // Levels below the lowest occupied one have nothing to fire or move
+        // down, so go straight to the next slot of that level.
+        size_t lowest = 0;
+        while(level_sizes_[lowest] == 0) ++lowest;
+        const uint64_t width = uint64_t{1} << (kSlotBits * lowest);
+        current_ = std::min(target, (current_ | (width - 1)) + 1);
+
+        // Top level first, so a timer can fall through several levels at once.
+        for(size_t level = kLevels - 1; level > 0; --level) {
+            if((current_ & ((uint64_t{1} << (kSlotBits * level)) - 1)) == 0) {
+                cascade(level);
+            }
+        }
+
+        std::vector<Timer>& slot = slots_[0][current_ & kSlotMask];
+        if(slot.empty()) continue;
+        spare_.swap(slot);
+        level_sizes_[0] -= spare_.size();
+        size_ -= spare_.size();
+        for(auto& timer : spare_) {
+            try {
+                timer.callback();
+            } catch(const std::exception& e) {
+                Log::error("Timer callback failed: ", e.what());
+            }
+        }
+        spare_.clear();
+    }
+}
+
+int TimerWheel::timeoutMs(uint64_t now_ns) const {
+    if(size_ == 0) return -1;
+
+    // The first occupied slot after the current one, on the lowest level
+    // that has any: the tick it fires (level 0) or moves down at.
+    for(size_t level = 0; level < kLevels; ++level) {
+        if(level_sizes_[level] == 0) continue;
+
+        const unsigned shift = kSlotBits * level;
+        const uint64_t position = current_ >> shift;
+        for(uint64_t offset = 1; offset < kSlots; ++offset) {
+            if(slots_[level][(position + offset) & kSlotMask].empty()) continue;
+
+            const uint64_t due = (position + offset) << shift;
+            const uint64_t now = now_ns / kTickNs;
+            if(due <= now) return 0;
+            return static_cast<int>(std::min<uint64_t>(due - now, 24 * 3600 * 1000));
+        }
+    }
+    return 0;
+}
+
+void TimerWheel::clear() {
+    for(auto& level : slots_) {
+        for(auto& slot : level) {
+            slot.clear();
+        }
+    }
+    level_sizes_.fill(0);
+    size_ = 0;
+}
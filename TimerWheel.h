@@ -0,0 +1,55 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Hierarchical timing wheel with 1 ms ticks: four levels of 256 slots
+// covering 256 ms, 65 s, 4.7 h and 49.7 days. Scheduling appends to one
+// slot; a slot on an upper level is spread over the level below when the
+// wheel reaches it, so each timer is touched at most once per level.
+// Timers cannot be cancelled: callbacks check whether they still apply.
+class TimerWheel {
+  public:
+    using Callback = std::function<void()>;
+
+    static constexpr uint64_t kTickNs = 1000000;
+
+    explicit TimerWheel(uint64_t now_ns = 0);
+
+    // Deadlines that already passed fire on the next tick.
+    void schedule(uint64_t deadline_ns, Callback callback);
+    // Runs every timer due by now_ns.
+    void advance(uint64_t now_ns);
+    // Milliseconds until advance() next has work to do (firing or moving
+    // timers down a level); -1 when no timer is pending.
+    int timeoutMs(uint64_t now_ns) const;
+    void clear();
+
+    size_t size() const {
+        return size_;
+    }
+
+  private:
+    static constexpr size_t kLevels = 4;
+    static constexpr unsigned kSlotBits = 8;
+    static constexpr size_t kSlots = size_t{1} << kSlotBits;
+    static constexpr uint64_t kSlotMask = kSlots - 1;
+
+    struct Timer {
+        uint64_t tick;
+        Callback callback;
+    };
+
+    void place(Timer timer);
+    void cascade(size_t level);
+
+    std::array<std::array<std::vector<Timer>, kSlots>, kLevels> slots_;
+    std::array<size_t, kLevels> level_sizes_{};
+    // Swapped with a slot being emptied, so slot buffers keep their capacity.
+    std::vector<Timer> spare_;
+    // The last tick advance() processed.
+    uint64_t current_;
+    size_t size_ = 0;
+};
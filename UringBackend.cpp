@@ -0,0 +1,397 @@
+#include "UringBackend.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint16_t kBufferGroup = 0;
+
+int uringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int uringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg, size_t size) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, size));
+}
+
+int uringRegister(int fd, unsigned opcode, void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+std::runtime_error failure(const std::string& what) {
+    return std::runtime_error(what + ": " + strerror(errno));
+}
+
+}
+
+UringBackend::UringBackend() {
+    try {
+        setup();
+    } catch(...) {
+        release();
+        throw;
+    }
+}
+
+UringBackend::~UringBackend() {
+    // Closing the ring cancels whatever is still in flight.
+    release();
+}
+
+void UringBackend::setup() {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    ring_fd_ = uringSetup(kEntries, &params);
+    if(ring_fd_ < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        ring_fd_ = uringSetup(kEntries, &params);
+    }
+    if(ring_fd_ < 0) {
+        throw failure("io_uring_setup failed");
+    }
+
+    const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if((params.features & required) != required) {
+        throw std::runtime_error("io_uring lacks single mmap, no-drop or extended enter arguments");
+    }
+
+    // Multishot recv and cancel-any arrived in Linux 6.0 together with
+    // zero-copy send, the last opcode this backend relies on being present.
+    std::vector<char> storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+    if(uringRegister(ring_fd_, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        throw failure("io_uring probe failed");
+    }
+    if(probe->last_op < IORING_OP_SEND_ZC) {
+        throw std::runtime_error("io_uring needs Linux 6.0 or newer for multishot recv");
+    }
+    for(int op : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL}) {
+        if(!(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            throw std::runtime_error("io_uring opcode " + std::to_string(op) + " is not supported");
+        }
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ring_size_ = std::max(sq_size, cq_size);
+    void* ring = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                      IORING_OFF_SQ_RING);
+    if(ring == MAP_FAILED) {
+        throw failure("mapping the io_uring rings failed");
+    }
+    ring_ = ring;
+
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                      IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        throw failure("mapping the io_uring submission entries failed");
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* base = static_cast<char*>(ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sq_array_ = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_local_tail_ = *sq_tail_;
+    cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+    cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+
+    void* buf_ring = mmap(nullptr, kBuffers * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(buf_ring == MAP_FAILED) {
+        throw failure("allocating the buffer ring failed");
+    }
+    buf_ring_ = static_cast<io_uring_buf*>(buf_ring);
+    void* buffers = mmap(nullptr, static_cast<size_t>(kBuffers) * kBufferSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(buffers == MAP_FAILED) {
+        throw failure("allocating receive buffers failed");
+    }
+    buffers_ = static_cast<char*>(buffers);
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+    reg.ring_entries = kBuffers;
+    reg.bgid = kBufferGroup;
+    if(uringRegister(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        throw failure("registering provided buffers failed");
+    }
+    for(unsigned i = 0; i < kBuffers; ++i) {
+        recycle(static_cast<uint16_t>(i));
+    }
+    publishBuffers();
+}
+
+void UringBackend::release() {
+    // Unregistered first so the ring's pages are unpinned before they are unmapped.
+    if(ring_fd_ != -1 && buf_ring_) {
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = kBufferGroup;
+        uringRegister(ring_fd_, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    if(ring_fd_ != -1) {
+        close(ring_fd_);
+        ring_fd_ = -1;
+    }
+    if(sqes_) {
+        munmap(sqes_, sqes_size_);
+        sqes_ = nullptr;
+    }
+    if(ring_) {
+        munmap(ring_, ring_size_);
+        ring_ = nullptr;
+    }
+    if(buffers_) {
+        munmap(buffers_, static_cast<size_t>(kBuffers) * kBufferSize);
+        buffers_ = nullptr;
+    }
+    if(buf_ring_) {
+        munmap(buf_ring_, kBuffers * sizeof(io_uring_buf));
+        buf_ring_ = nullptr;
+    }
+}
+
+// Submits everything queued so far and, if wait_for > 0, waits up to
+// timeout_ms (-1: indefinitely) for that many completions.
+int UringBackend::enter(unsigned wait_for, int timeout_ms) {
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+    unsigned pending = sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if(pending == 0 && wait_for == 0) return 0;
+
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    if(wait_for > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if(timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+    }
+
+    int result = uringEnter(ring_fd_, pending, wait_for, flags, &arg, sizeof(arg));
+    if(result < 0) {
+        // Interrupted, timed out, or completions must be reaped first.
+        if(errno == EINTR || errno == ETIME || errno == EBUSY || errno == EAGAIN) return 0;
+        throw failure("io_uring_enter failed");
+    }
+    return result;
+}
+
+io_uring_sqe* UringBackend::nextSqe() {
+    if(sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+        enter(0, 0);
+    }
+    unsigned index = sq_local_tail_ & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    ++sq_local_tail_;
+    return sqe;
+}
+
+UringBackend::Source& UringBackend::track(int fd, Op op) {
+    Source& source = sources_[fd];
+    source = Source{};
+    source.op = op;
+    source.generation = ++next_generation_;
+    return source;
+}
+
+void UringBackend::arm(int fd, const Source& source) {
+    io_uring_sqe* sqe = nextSqe();
+    sqe->fd = fd;
+    sqe->user_data = userData(fd, source.generation, source.op);
+    switch(source.op) {
+    case Op::Watch:
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        break;
+    case Op::Accept:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        break;
+    default:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = kBufferGroup;
+        break;
+    }
+}
+
+void UringBackend::watch(int fd, Handler handler) {
+    Source& source = track(fd, Op::Watch);
+    source.handler = std::move(handler);
+    arm(fd, source);
+}
+
+void UringBackend::listen(int fd, AcceptHandler handler) {
+    Source& source = track(fd, Op::Accept);
+    source.on_accept = std::move(handler);
+    arm(fd, source);
+}
+
+void UringBackend::add(int fd, std::shared_ptr<IoConnection> connection) {
+    Source& source = track(fd, Op::Receive);
+    source.connection = std::move(connection);
+    arm(fd, source);
+}
+
+void UringBackend::waitWritable(int fd) {
+    auto it = sources_.find(fd);
+    if(it == sources_.end() || it->second.write_armed) return;
+
+    io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = userData(fd, it->second.generation, Op::Writable);
+    it->second.write_armed = true;
+}
+
+void UringBackend::cancel(uint64_t user_data) {
+    io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = userData(0, 0, Op::Cancel);
+}
+
+void UringBackend::remove(int fd) {
+    auto it = sources_.find(fd);
+    if(it == sources_.end()) return;
+
+    // Cancelled by exact request rather than by fd: the number may be
+    // closed and handed to a new connection before the cancel runs.
+    cancel(userData(fd, it->second.generation, it->second.op));
+    if(it->second.write_armed) {
+        cancel(userData(fd, it->second.generation, Op::Writable));
+    }
+    // The connection may be the one currently running, so keep it alive
+    // until the current batch of completions has been dispatched. Outside
+    // a batch it goes now: the loop may not wake up again for a long time.
+    if(dispatching_) {
+        retired_.push_back(std::move(it->second));
+    }
+    sources_.erase(it);
+}
+
+void UringBackend::clear() {
+    if(ring_fd_ == -1) return;
+
+    io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->user_data = userData(0, 0, Op::Cancel);
+    // Submitted right away so the sockets are released without another poll().
+    enter(0, 0);
+    sources_.clear();
+    retired_.clear();
+}
+
+int UringBackend::poll(int timeout_ms) {
+    bool ready = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) != *cq_head_;
+    enter(ready || timeout_ms == 0 ? 0 : 1, timeout_ms);
+
+    int handled = 0;
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    dispatching_ = true;
+    while(head != tail) {
+        io_uring_cqe cqe = cqes_[head & cq_mask_];
+        __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+        dispatch(cqe);
+        ++handled;
+    }
+    dispatching_ = false;
+    // Buffers handed back during the batch become available to the kernel
+    // before any recv re-armed here is submitted.
+    publishBuffers();
+    retired_.clear();
+    return handled;
+}
+
+void UringBackend::dispatch(const io_uring_cqe& cqe) {
+    int fd = static_cast<int>(cqe.user_data >> 32);
+    uint32_t generation = static_cast<uint32_t>(cqe.user_data >> 8) & 0xffffff;
+    Op op = static_cast<Op>(cqe.user_data & 0xff);
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    int buffer = cqe.flags & IORING_CQE_F_BUFFER ? static_cast<int>(cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+    auto it = op == Op::Cancel ? sources_.end() : sources_.find(fd);
+    if(it == sources_.end() || (it->second.generation & 0xffffff) != generation) {
+        if(buffer >= 0) recycle(static_cast<uint16_t>(buffer));
+        return;
+    }
+    Source& source = it->second;
+
+    // Multishot requests end on errors, a full completion queue or an
+    // empty buffer ring; re-arming first leaves source free to go away in
+    // the callback.
+    switch(op) {
+    case Op::Watch:
+        if(!more) arm(fd, source);
+        source.handler();
+        break;
+    case Op::Accept:
+        if(!more) arm(fd, source);
+        if(cqe.res != -ECANCELED) source.on_accept(cqe.res);
+        break;
+    case Op::Receive: {
+        IoConnection* connection = source.connection.get();
+        if(cqe.res == -ENOBUFS || (cqe.res > 0 && !more)) arm(fd, source);
+        if(cqe.res > 0) {
+            if(buffer >= 0) connection->onReceived(buffers_ + static_cast<size_t>(buffer) * kBufferSize, cqe.res);
+        } else if(cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+            connection->onReceived(nullptr, cqe.res);
+        }
+        break;
+    }
+    case Op::Writable:
+        source.write_armed = false;
+        if(cqe.res != -ECANCELED) source.connection->onWritable();
+        break;
+    default:
+        break;
+    }
+
+    if(buffer >= 0) recycle(static_cast<uint16_t>(buffer));
+}
+
+void UringBackend::recycle(uint16_t buffer) {
+    io_uring_buf& slot = buf_ring_[buf_tail_ & (kBuffers - 1)];
+    slot.addr = reinterpret_cast<uint64_t>(buffers_ + static_cast<size_t>(buffer) * kBufferSize);
+    slot.len = kBufferSize;
+    slot.bid = buffer;
+    ++buf_tail_;
+}
+
+// The ring's tail overlays the reserved field of its first entry (see
+// io_uring_buf_ring). The entries are addressed as a plain array because
+// the header's flexible-array wrapper lays them out 8 bytes late in C++.
+void UringBackend::publishBuffers() {
+    __atomic_store_n(&buf_ring_[0].resv, buf_tail_, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <linux/io_uring.h>
+#include "IoBackend.h"
+
+// Completion-based backend on a raw io_uring (no liburing needed): one
+// multishot accept per listener, one multishot recv per connection reading
+// into a ring of provided buffers shared by the whole shard, and multishot
+// poll for watched descriptors. Writes stay non-blocking sendmsg() calls
+// made by the connection, already batched to one per loop turn; a one-shot
+// POLLOUT request stands in for EPOLLOUT when a socket fills up. Requests
+// queued during a loop turn go to the kernel with the io_uring_enter() that
+// waits for the next completions.
+class UringBackend : public IoBackend {
+  public:
+    static constexpr unsigned kEntries = 1024;
+    static constexpr unsigned kBuffers = 256;
+    static constexpr unsigned kBufferSize = 8192;
+
+    // Throws std::runtime_error when the kernel lacks anything the backend uses.
+    UringBackend();
+    ~UringBackend() override;
+    UringBackend(const UringBackend&) = delete;
+    UringBackend& operator=(const UringBackend&) = delete;
+
+    const char* name() const override {
+        return "io_uring";
+    }
+    void watch(int fd, Handler handler) override;
+    void listen(int fd, AcceptHandler handler) override;
+    void add(int fd, std::shared_ptr<IoConnection> connection) override;
+    void waitWritable(int fd) override;
+    void remove(int fd) override;
+    void clear() override;
+    int poll(int timeout_ms) override;
+    size_t size() const override {
+        return sources_.size();
+    }
+
+  private:
+    enum class Op : uint8_t {
+        Watch,
+        Accept,
+        Receive,
+        Writable,
+        Cancel
+    };
+
+    // A registered descriptor. Completions carry its fd and generation, so
+    // ones still in flight for a removed (and possibly reused) fd are dropped.
+    struct Source {
+        Op op;
+        uint32_t generation;
+        Handler handler;
+        AcceptHandler on_accept;
+        std::shared_ptr<IoConnection> connection;
+        bool write_armed = false;
+    };
+
+    static uint64_t userData(int fd, uint32_t generation, Op op) {
+        return static_cast<uint64_t>(fd) << 32 | (generation & 0xffffff) << 8 | static_cast<uint64_t>(op);
+    }
+
+    void setup();
+    void release();
+    int enter(unsigned wait_for, int timeout_ms);
+    io_uring_sqe* nextSqe();
+    Source& track(int fd, Op op);
+    void arm(int fd, const Source& source);
+    void cancel(uint64_t user_data);
+    void dispatch(const io_uring_cqe& cqe);
+    void recycle(uint16_t buffer);
+    void publishBuffers();
+
+    int ring_fd_ = -1;
+    void* ring_ = nullptr;
+    size_t ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sq_local_tail_ = 0;
+
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned cq_mask_ = 0;
+
+    io_uring_buf* buf_ring_ = nullptr;
+    char* buffers_ = nullptr;
+    uint16_t buf_tail_ = 0;
+
+    uint32_t next_generation_ = 0;
+    std::unordered_map<int, Source> sources_;
+    std::vector<Source> retired_;
+    bool dispatching_ = false;
+};
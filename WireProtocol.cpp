@@ -0,0 +1,124 @@
+#include "WireProtocol.h"
+#include <cstring>
+
+namespace WireProtocol {
+
+static uint16_t get16(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<uint16_t>((u[0] << 8) | u[1]);
+}
+
+static uint32_t get32(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return (static_cast<uint32_t>(u[0]) << 24) | (static_cast<uint32_t>(u[1]) << 16) |
+           (static_cast<uint32_t>(u[2]) << 8) | static_cast<uint32_t>(u[3]);
+}
+
+static void put16(std::string& out, uint16_t value) {
+    out += static_cast<char>((value >> 8) & 0xff);
+    out += static_cast<char>(value & 0xff);
+}
+
+static void put32(std::string& out, uint32_t value) {
+    out += static_cast<char>((value >> 24) & 0xff);
+    out += static_cast<char>((value >> 16) & 0xff);
+    out += static_cast<char>((value >> 8) & 0xff);
+    out += static_cast<char>(value & 0xff);
+}
+
+static void set32(char* p, uint32_t value) {
+    p[0] = static_cast<char>((value >> 24) & 0xff);
+    p[1] = static_cast<char>((value >> 16) & 0xff);
+    p[2] = static_cast<char>((value >> 8) & 0xff);
+    p[3] = static_cast<char>(value & 0xff);
+}
+
+ParseResult parse(const char* data, size_t len, FrameView& frame, size_t& consumed) {
+    if(len < kHeaderSize) return ParseResult::Incomplete;
+
+    uint32_t body_length = get32(data);
+    uint8_t type = static_cast<uint8_t>(data[4]);
+    uint16_t sender_length = get16(data + 6);
+    uint16_t receiver_length = get16(data + 8);
+    uint32_t content_length = get32(data + 10);
+
+    size_t expected = kHeaderSize - 4 + sender_length + receiver_length + size_t(content_length);
+    if(body_length != expected || body_length + 4 > kMaxFrameSize ||
+       type > static_cast<uint8_t>(MessageType::RoomMessage)) {
+        return ParseResult::Invalid;
+    }
+    if(len < body_length + 4) return ParseResult::Incomplete;
+
+    const char* p = data + kHeaderSize;
+    frame.type = static_cast<MessageType>(type);
+    frame.sender = std::string_view(p, sender_length);
+    p += sender_length;
+    frame.receiver = std::string_view(p, receiver_length);
+    p += receiver_length;
+    frame.content = std::string_view(p, content_length);
+    consumed = body_length + 4;
+    return ParseResult::Ok;
+}
+
+Payload encode(MessageType type, std::string_view sender,
+               std::string_view content, std::string_view receiver) {
+    return Payload::build([&](std::string& out) {
+        out.reserve(kHeaderSize + sender.size() + receiver.size() + content.size());
+        put32(out, static_cast<uint32_t>(kHeaderSize - 4 + sender.size() + receiver.size() + content.size()));
+        out += static_cast<char>(type);
+        out += '\0';
+        put16(out, static_cast<uint16_t>(sender.size()));
+        put16(out, static_cast<uint16_t>(receiver.size()));
+        put32(out, static_cast<uint32_t>(content.size()));
+        out.append(sender);
+        out.append(receiver);
+        out.append(content);
+    });
+}
+
+Payload encode(const MessageView& msg) {
+    return encode(msg.getType(), msg.getSender(), msg.getContent(), msg.getReceiver());
+}
+
+Payload preamble() {
+    static const Payload payload = Payload::raw(std::string(kPreamble, kPreambleSize));
+    return payload;
+}
+
+static void appendStripped(std::string& out, std::string_view text) {
+    for(size_t i = 0; i < text.size(); ++i) {
+        if(text[i] == '\033' && i + 1 < text.size() && text[i + 1] == '[') {
+            i += 2;
+            while(i < text.size() && !(text[i] >= '@' && text[i] <= '~')) {
+                ++i;
+            }
+            continue;
+        }
+        if(text[i] == '\r') continue;
+        out += text[i];
+    }
+}
+
+Payload notice(std::string_view text) {
+    return Payload::build([&](std::string& out) {
+        out.reserve(kHeaderSize + text.size());
+        out.append(kHeaderSize, '\0');
+        appendStripped(out, text);
+
+        // Lengths are only known once the escapes are gone, so the header
+        // is reserved up front and patched in place.
+        uint32_t content_length = static_cast<uint32_t>(out.size() - kHeaderSize);
+        set32(&out[0], static_cast<uint32_t>(kHeaderSize - 4) + content_length);
+        out[4] = static_cast<char>(MessageType::System);
+        set32(&out[10], content_length);
+    });
+}
+
+std::string stripAnsi(std::string_view text) {
+    std::string out;
+    out.reserve(text.size());
+    appendStripped(out, text);
+    return out;
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "Message.h"
+#include "MessageType.h"
+#include "Payload.h"
+
+// Binary framing used by bot clients. A client opts in by sending kPreamble
+// as its very first bytes; the server answers with the same preamble and
+// from then on both sides exchange frames instead of text lines. Anything
+// received before the echoed preamble is the text greeting and is ignored.
+//
+// Frame layout (integers in network byte order):
+//   u32 body_length   bytes following this field
+//   u8  type          MessageType
+//   u8  reserved      0
+//   u16 sender_length
+//   u16 receiver_length
+//   u32 content_length
+//   sender, receiver, content bytes
+namespace WireProtocol {
+
+constexpr char kPreamble[] = {'\0', 'C', 'H', 'A', 'T', '/', 'B', '1', '\n'};
+constexpr size_t kPreambleSize = sizeof(kPreamble);
+constexpr size_t kHeaderSize = 14;
+constexpr size_t kMaxFrameSize = 64 * 1024;
+
+enum class WireFormat {
+    Text,
+    Binary
+};
+
+struct FrameView {
+    MessageType type;
+    std::string_view sender;
+    std::string_view receiver;
+    std::string_view content;
+};
+
+enum class ParseResult {
+    Ok,
+    Incomplete,
+    Invalid
+};
+
+ParseResult parse(const char* data, size_t len, FrameView& frame, size_t& consumed);
+Payload encode(MessageType type, std::string_view sender,
+               std::string_view content, std::string_view receiver = {});
+Payload encode(const MessageView& msg);
+Payload preamble();
+// System frame carrying text with its ANSI colour codes removed.
+Payload notice(std::string_view text);
+std::string stripAnsi(std::string_view text);
+
+}
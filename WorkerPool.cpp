@@ -0,0 +1,107 @@
+#include "WorkerPool.h"
+#include "Log.h"
+#include <exception>
+
+// The pool and worker the calling thread belongs to, if it is a worker.
+static thread_local const WorkerPool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+WorkerPool::WorkerPool(size_t threads) {
+    if(threads == 0) threads = 1;
+    for(size_t i = 0; i < threads; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for(size_t i = 0; i < threads; ++i) {
+        workers_[i]->thread = std::thread(&WorkerPool::run, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    stop();
+}
+
+void WorkerPool::submit(Task task) {
+    size_t index = current_pool == this ? current_worker
+                                        : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    {
+        std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+        workers_[index]->tasks.push_back(std::move(task));
+    }
+
+    // Pairs with the sleeping_ increment in run(): either the worker sees
+    // the new task before it sleeps, or this sees it asleep and wakes it.
+    pending_.fetch_add(1, std::memory_order_seq_cst);
+    if(sleeping_.load(std::memory_order_seq_cst) > 0) {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+        }
+        idle_.notify_one();
+    }
+}
+
+void WorkerPool::stop() {
+    if(stopping_.exchange(true)) return;
+
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+    }
+    idle_.notify_all();
+    for(auto& worker : workers_) {
+        if(worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+    for(auto& worker : workers_) {
+        worker->tasks.clear();
+    }
+}
+
+bool WorkerPool::take(size_t index, Task& task) {
+    {
+        Worker& own = *workers_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.tasks.empty()) {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    for(size_t i = 1; i < workers_.size(); ++i) {
+        Worker& victim = *workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            stolen_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerPool::run(size_t index) {
+    current_pool = this;
+    current_worker = index;
+
+    Task task;
+    while(!stopping_) {
+        if(take(index, task)) {
+            pending_.fetch_sub(1, std::memory_order_relaxed);
+            try {
+                task();
+            } catch(const std::exception& e) {
+                Log::error("[Worker ", index, "] ", e.what());
+            }
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(idle_mutex_);
+        sleeping_.fetch_add(1, std::memory_order_seq_cst);
+        idle_.wait(lock, [this] {
+            return pending_.load(std::memory_order_seq_cst) > 0 || stopping_;
+        });
+        sleeping_.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool for message dispatch. Every worker owns a
+// deque: tasks submitted from a worker go to its own deque, tasks from any
+// other thread are spread round-robin. A worker takes from the front of
+// its own deque and, once that is empty, steals from the back of the
+// others' before going to sleep. Tasks run in no particular order; callers
+// that need one (a client's messages) chain their work themselves.
+class WorkerPool {
+  public:
+    using Task = std::function<void()>;
+
+    explicit WorkerPool(size_t threads);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void submit(Task task);
+    // Joins the workers; tasks still queued are dropped.
+    void stop();
+
+    size_t size() const {
+        return workers_.size();
+    }
+    // Tasks a worker took from another worker's deque.
+    size_t stolen() const {
+        return stolen_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    void run(size_t index);
+    bool take(size_t index, Task& task);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<size_t> next_{0};
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> sleeping_{0};
+    std::atomic<size_t> stolen_{0};
+    std::atomic<bool> stopping_{false};
+    std::mutex idle_mutex_;
+    std::condition_variable idle_;
+};
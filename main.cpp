@@ -1,38 +1,82 @@
 #include "ChatServer.h"
+#include "Log.h"
 #include <csignal>
+#include <cstdlib>
 #include <iostream>
 #include <memory>
-#include <thread>
+#include <pthread.h>
+#include <string_view>
 #include <chrono>
-#include <atomic>
 
-std::unique_ptr<ChatServer> server;
-volatile std::sig_atomic_t gSignalStatus;
+int main(int argc, char* argv[]) {
+    const int PORT = 55555;
 
-void signalHandler(int signal) {
-    gSignalStatus = signal;
-    if(server) {
-        server->stop();
-    }
-}
+    // SIGINT and SIGTERM are blocked before any thread exists, so every
+    // thread inherits the mask and only the sigwait() below takes them: the
+    // server is stopped as soon as one arrives, from ordinary code rather
+    // than from inside a signal handler.
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
 
-int main() {
-    const int PORT = 55555;
-    server = std::make_unique<ChatServer>(PORT);
+    if(const char* level = std::getenv("CHAT_LOG_LEVEL")) {
+        Log::setLevel(Log::parseLevel(level, Log::level()));
+    }
+    // Optional argument: number of reactor shards (default: one per core).
+    size_t shards = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 0;
+    IoBackendKind io_backend = IoBackendKind::Epoll;
+    if(const char* backend = std::getenv("CHAT_IO_BACKEND")) {
+        if(!parseIoBackend(backend, io_backend)) {
+            std::cerr << "Unknown CHAT_IO_BACKEND '" << backend << "', using epoll\n";
+        }
+    }
+    auto server = std::make_unique<ChatServer>(PORT, shards, io_backend);
+    if(const char* policy = std::getenv("CHAT_BACKPRESSURE")) {
+        BackpressureConfig config;
+        if(parsePolicy(policy, config.policy)) {
+            server->setBackpressure(config);
+        } else {
+            std::cerr << "Unknown CHAT_BACKPRESSURE policy '" << policy << "', using drop-oldest\n";
+        }
+    }
 
-    std::signal(SIGINT, signalHandler);
-    std::signal(SIGTERM, signalHandler);
+    if(const char* flood = std::getenv("CHAT_FLOOD")) {
+        FloodConfig config;
+        if(std::string_view(flood) == "off") {
+            config.messages_per_sec = 0;
+            config.bytes_per_sec = 0;
+            server->setFloodControl(config);
+        } else if(parseFloodPolicy(flood, config.policy)) {
+            server->setFloodControl(config);
+        } else {
+            std::cerr << "Unknown CHAT_FLOOD policy '" << flood << "', using throttle\n";
+        }
+    }
+    // Seconds; 0 turns the timer off.
+    TimeoutConfig timeouts;
+    if(const char* idle = std::getenv("CHAT_IDLE_TIMEOUT")) {
+        timeouts.idle = std::chrono::seconds(std::strtoul(idle, nullptr, 10));
+    }
+    if(const char* keepalive = std::getenv("CHAT_KEEPALIVE")) {
+        timeouts.keepalive = std::chrono::seconds(std::strtoul(keepalive, nullptr, 10));
+    }
+    server->setTimeouts(timeouts);
+    if(const char* workers = std::getenv("CHAT_WORKERS")) {
+        server->setWorkers(std::strtoul(workers, nullptr, 10));
+    }
 
     try {
         server->start();
         std::cout << "Server running. Press Ctrl+C to stop.\n";
 
-        while(gSignalStatus == 0) {
-            std::this_thread::sleep_for(std::chrono::seconds(1));
-        }
+        int signal = 0;
+        sigwait(&stop_signals, &signal);
 
-        std::cout << "\nReceived signal " << gSignalStatus
+        std::cout << "\nReceived signal " << signal
                   << ", shutting down gracefully...\n";
+        server->stop();
     } catch(const std::exception& e) {
         std::cerr << "Server error: " << e.what() << std::endl;
         return 1;